@@ -8,12 +8,34 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 #include <getopt.h>
 #include <ctype.h>
 
 #include <math.h>
 
+// element types selectable at runtime with -t, the USE_INT / USE_FLT
+// build option only picks the default
+typedef enum
+{
+    DTYPE_INT32,
+    DTYPE_INT64,
+    DTYPE_UINT32,
+    DTYPE_UINT64,
+    DTYPE_FLOAT,
+    DTYPE_DOUBLE
+} dtype_id;
+
+#ifdef USE_FLT
+    #define DTYPE_DEFAULT DTYPE_FLOAT
+#else
+    #define DTYPE_DEFAULT DTYPE_INT32
+#endif
+
+#define DTYPE_NAME_LIST "int32|int64|uint32|uint64|float|double"
+
 // function
 
 void parse_args(
@@ -27,4 +49,23 @@ void parse_args(
     )
 );
 
+
+// exit on a name outside DTYPE_NAME_LIST
+dtype_id parse_dtype(const char* name);
+
+size_t dtype_size(const dtype_id id);
+
+// negative, zero or positive like memcmp, on values of type id
+int dtype_compare(const dtype_id id, const void* lhs, const void* rhs);
+
+// print one value of type id followed by a space
+void dtype_print(const dtype_id id, const void* value);
+
+// store an integer as a value of type id
+void dtype_store(const dtype_id id, const long long number, void* value);
+
+// store random bits as a value of type id, integers keep the low bits,
+// floating point types get them as a signed 64-bit integer
+void dtype_store_bits(const dtype_id id, const uint64_t bits, void* value);
+
 #endif
@@ -0,0 +1,397 @@
+#ifndef BLOCKIO_H
+#define BLOCKIO_H
+
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <record.h>
+
+/*
+* block_reader - sequential reader of one sorted run, refills a whole
+*                block per disk read instead of one element at a time
+* block_size - number of elements held in memory for this run
+*/
+template<typename dtype>
+class block_reader
+{
+public:
+    block_reader(const std::string& file_path, const size_t& block_size)
+        : finput(file_path, std::ifstream::binary), block(block_size), cursor(0), length(0)
+    {
+    }
+
+    bool is_open() const
+    {
+        return finput.is_open();
+    }
+
+    // fetch the next element, return false once the run is exhausted
+    bool next(dtype& value)
+    {
+        if (cursor == length && !fill())
+            return false;
+        value = block[cursor++];
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        if (!finput.is_open())
+            return false;
+
+        finput.read(reinterpret_cast<char*>(block.data()), sizeof(dtype) * block.size());
+        length = finput.gcount() / sizeof(dtype);
+        cursor = 0;
+        if (length == 0)
+        {
+            // release the block as soon as the run is drained
+            finput.close();
+            std::vector<dtype>().swap(block);
+            return false;
+        }
+        return true;
+    }
+
+    std::ifstream finput;
+    std::vector<dtype> block;
+    size_t cursor;
+    size_t length;
+};
+
+/*
+* block_writer - sequential writer that only touches the disk when
+*                a whole block is filled up
+* block_size - number of elements buffered before each flush
+*/
+template<typename dtype>
+class block_writer
+{
+public:
+    block_writer(const std::string& file_path, const size_t& block_size)
+        : foutput(file_path, std::ofstream::binary), block(block_size), length(0)
+    {
+    }
+
+    ~block_writer()
+    {
+        close();
+    }
+
+    bool is_open() const
+    {
+        return foutput.is_open();
+    }
+
+    void put(const dtype& value)
+    {
+        block[length++] = value;
+        if (length == block.size())
+            flush();
+    }
+
+    void flush()
+    {
+        if (length == 0) return;
+        foutput.write(reinterpret_cast<const char*>(block.data()), sizeof(dtype) * length);
+        length = 0;
+    }
+
+    void close()
+    {
+        if (!foutput.is_open()) return;
+        flush();
+        foutput.close();
+    }
+
+private:
+    std::ofstream foutput;
+    std::vector<dtype> block;
+    size_t length;
+};
+
+// <dir>/<stem>_index.bin next to a value file written by index_writer
+inline std::string index_file_path(const std::string& file_path)
+{
+    std::filesystem::path path(file_path);
+    return (path.parent_path() / (path.stem().string() + "_index.bin")).string();
+}
+
+/*
+* index_writer - block writer for indexed elements that splits them on
+*                the way out, the values go to file_path as plain dtype
+*                and the positions to index_file_path(file_path), so the
+*                last merge produces both files without another pass
+*/
+template<typename dtype>
+class index_writer
+{
+public:
+    index_writer(const std::string& file_path, const size_t& block_size)
+        : value_out(file_path, block_size), index_out(index_file_path(file_path), block_size)
+    {
+    }
+
+    bool is_open() const
+    {
+        return value_out.is_open() && index_out.is_open();
+    }
+
+    void put(const indexed<dtype>& value)
+    {
+        value_out.put(value.value);
+        index_out.put(value.idx);
+    }
+
+    void close()
+    {
+        value_out.close();
+        index_out.close();
+    }
+
+private:
+    block_writer<dtype> value_out;
+    block_writer<uint64_t> index_out;
+};
+
+/*
+* segment_sink - one write-behind buffer per source for the whole
+*                exchange, seg_dir/<src>.bin stays open until close()
+* total_list - elements expected from each source, used to preallocate
+*              the segment files so they do not grow round by round
+* block_size - number of elements buffered per source before a write
+*/
+template<typename dtype>
+class segment_sink
+{
+public:
+    segment_sink(
+        const std::string& seg_dir,
+        const std::vector<size_t>& total_list,
+        const size_t& block_size,
+        const bool& preallocate = true
+    ) : block_size(block_size), failed(false)
+    {
+        slot_list.resize(total_list.size());
+        for (size_t src = 0; src < total_list.size(); ++src)
+        {
+            slot& sl = slot_list[src];
+            std::string path = seg_dir + "/" + std::to_string(src) + ".bin";
+            sl.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (sl.fd < 0)
+            {
+                failed = true;
+                continue;
+            }
+            // a filesystem without fallocate support just grows the file,
+            // anything else (e.g. no space left) is a write failure
+            if (preallocate && total_list[src] > 0)
+            {
+                int err = posix_fallocate(sl.fd, 0, sizeof(dtype) * total_list[src]);
+                if (err != 0 && err != EOPNOTSUPP && err != EINVAL)
+                {
+                    failed = true;
+                    continue;
+                }
+            }
+            sl.block.resize(block_size);
+        }
+    }
+
+    ~segment_sink()
+    {
+        close();
+    }
+
+    segment_sink(const segment_sink&) = delete;
+    segment_sink& operator=(const segment_sink&) = delete;
+
+    bool is_open() const
+    {
+        return !failed;
+    }
+
+    // append cnt elements received from src
+    void put(const int& src, const dtype* data, size_t cnt)
+    {
+        slot& sl = slot_list[src];
+        if (sl.length + cnt > block_size)
+        {
+            flush(sl);
+            // large chunk goes to disk directly instead of through the block
+            if (cnt >= block_size)
+            {
+                write_all(sl, data, cnt);
+                return;
+            }
+        }
+        memcpy(sl.block.data() + sl.length, data, sizeof(dtype) * cnt);
+        sl.length += cnt;
+    }
+
+    // flush every source and cut off preallocated space that is not used,
+    // return false if any segment failed to open or write
+    bool close()
+    {
+        for (slot& sl : slot_list)
+        {
+            if (sl.fd < 0) continue;
+            flush(sl);
+            if (ftruncate(sl.fd, sizeof(dtype) * sl.written) != 0)
+                failed = true;
+            ::close(sl.fd);
+            sl.fd = -1;
+            std::vector<dtype>().swap(sl.block);
+        }
+        return !failed;
+    }
+
+private:
+    struct slot
+    {
+        int fd = -1;
+        std::vector<dtype> block;
+        size_t length = 0;  // elements waiting in block
+        size_t written = 0; // elements already on disk
+    };
+
+    void flush(slot& sl)
+    {
+        if (sl.length == 0) return;
+        write_all(sl, sl.block.data(), sl.length);
+        sl.length = 0;
+    }
+
+    void write_all(slot& sl, const dtype* data, const size_t& cnt)
+    {
+        const char* ptr = reinterpret_cast<const char*>(data);
+        size_t left = sizeof(dtype) * cnt;
+        while (left > 0)
+        {
+            ssize_t put_cnt = write(sl.fd, ptr, left);
+            if (put_cnt <= 0)
+            {
+                failed = true;
+                return;
+            }
+            ptr += put_cnt;
+            left -= put_cnt;
+        }
+        sl.written += cnt;
+    }
+
+    std::vector<slot> slot_list;
+    size_t block_size;
+    bool failed;
+};
+
+/*
+* span_reader - block buffered reader over elements [first, first + cnt)
+*               of an open fd, walks the span forward or backward
+*/
+template<typename dtype>
+class span_reader
+{
+public:
+    span_reader(int fd, size_t first, size_t cnt, bool backward, size_t block_size)
+        : fd(fd), lo(first), hi(first + cnt), backward(backward),
+          block(std::max<size_t>(block_size, 1)), cursor(0), length(0)
+    {
+    }
+
+    bool next(dtype& value)
+    {
+        if (cursor == length && !fill())
+            return false;
+        value = backward ? block[length - 1 - cursor++] : block[cursor++];
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        length = std::min(block.size(), hi - lo);
+        cursor = 0;
+        if (length == 0)
+            return false;
+        size_t from = backward ? hi - length : lo;
+        if (pread(fd, block.data(), sizeof(dtype) * length, sizeof(dtype) * from) != (ssize_t)(sizeof(dtype) * length))
+        {
+            length = 0;
+            return false;
+        }
+        if (backward) hi -= length;
+        else          lo += length;
+        return true;
+    }
+
+    int fd;
+    size_t lo, hi; // elements not loaded yet
+    bool backward;
+    std::vector<dtype> block;
+    size_t cursor;
+    size_t length;
+};
+
+/*
+* span_writer - block buffered writer filling elements [first, first + cnt)
+*               of an open fd in place, forward or backward
+*/
+template<typename dtype>
+class span_writer
+{
+public:
+    span_writer(int fd, size_t first, size_t cnt, bool backward, size_t block_size)
+        : fd(fd), lo(first), hi(first + cnt), backward(backward),
+          block(std::max<size_t>(block_size, 1)), length(0), failed(false)
+    {
+    }
+
+    ~span_writer()
+    {
+        flush();
+    }
+
+    void put(const dtype& value)
+    {
+        block[length++] = value;
+        if (length == block.size())
+            flush();
+    }
+
+    // return false if any write fell short
+    bool flush()
+    {
+        if (length == 0) return !failed;
+        size_t to = lo;
+        if (backward)
+        {
+            std::reverse(block.begin(), block.begin() + length);
+            to = hi - length;
+        }
+        if (pwrite(fd, block.data(), sizeof(dtype) * length, sizeof(dtype) * to) != (ssize_t)(sizeof(dtype) * length))
+            failed = true;
+        if (backward) hi -= length;
+        else          lo += length;
+        length = 0;
+        return !failed;
+    }
+
+private:
+    int fd;
+    size_t lo, hi; // elements not written yet
+    bool backward;
+    std::vector<dtype> block;
+    size_t length;
+    bool failed;
+};
+
+#endif
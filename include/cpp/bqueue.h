@@ -0,0 +1,54 @@
+#ifndef BQUEUE_H
+#define BQUEUE_H
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+/*
+* blocking_queue - unbounded fifo shared between threads, pop waits
+*                  until an element arrives or the queue is closed
+*/
+template <typename element>
+class blocking_queue
+{
+private:
+    std::queue<element> items;
+    std::mutex lock;
+    std::condition_variable ready;
+    bool closed = false;
+
+public:
+    void push(element ele)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            items.push(std::move(ele));
+        }
+        ready.notify_one();
+    }
+
+    // return false only when the queue is closed and drained
+    bool pop(element& ele)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [this]() { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        ele = std::move(items.front());
+        items.pop();
+        return true;
+    }
+
+    // wake up every waiting consumer, no more element will be pushed
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+};
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstdint>
 
 #include <stdexcept>
 #include <iostream>
@@ -24,12 +25,22 @@
 
 #include <functional>
 #include <memory>
+#include <thread>
 
 // other
 #include <myheap.h>
+#include <losertree.h>
+#include <blockio.h>
+#include <bqueue.h>
+#include <radixsort.h>
+#include <sortkey.h>
+#include <record.h>
+#include <runview.h>
+#include <streammerge.h>
 
 // c part
 #include <unistd.h>
+#include <sys/resource.h>
 #include <stdio.h>
 #include <getopt.h>
 #include <ctype.h>
@@ -50,81 +61,461 @@ void parse_args(
 
 void clean_up(std::vector<std::string> dirs);
 
+/*
+* element types selectable at runtime with -t, the USE_INT / USE_FLT build
+* option only picks the default, every engine is instantiated for all
+*/
+#ifdef USE_FLT
+    #define DTYPE_DEFAULT_NAME "float"
+#else
+    #define DTYPE_DEFAULT_NAME "int32"
+#endif
+#define DTYPE_NAME_LIST "int32|int64|uint32|uint64|float|double"
+
 template<typename dtype>
-void kmerge_file(
+struct dtype_tag
+{
+    typedef dtype type;
+};
+
+/*
+* dispatch_dtype - call visit(dtype_tag<T>()) with the type named by
+*                  dtype_name, generic lambdas then instantiate their body
+*                  once per type
+*/
+template<typename visitor>
+int dispatch_dtype(const std::string& dtype_name, visitor&& visit)
+{
+    if (dtype_name == "int32")  return visit(dtype_tag<int32_t>());
+    if (dtype_name == "int64")  return visit(dtype_tag<int64_t>());
+    if (dtype_name == "uint32") return visit(dtype_tag<uint32_t>());
+    if (dtype_name == "uint64") return visit(dtype_tag<uint64_t>());
+    if (dtype_name == "float")  return visit(dtype_tag<float>());
+    if (dtype_name == "double") return visit(dtype_tag<double>());
+    fprintf(stderr, "unknown data type %s, use one of %s\n", dtype_name.c_str(), DTYPE_NAME_LIST);
+    exit(1);
+}
+
+/*
+* fixed record layouts for engines that sort key + payload records, rec8
+* has a uint32 key and the wider ones a uint64 key
+*/
+#define RECORD_NAME_LIST "rec8|rec16|rec64|rec128"
+
+/*
+* dispatch_record - dispatch_dtype that also accepts RECORD_NAME_LIST
+*/
+template<typename visitor>
+int dispatch_record(const std::string& dtype_name, visitor&& visit)
+{
+    if (dtype_name == "rec8")   return visit(dtype_tag<record<uint32_t, 8>>());
+    if (dtype_name == "rec16")  return visit(dtype_tag<record<uint64_t, 16>>());
+    if (dtype_name == "rec64")  return visit(dtype_tag<record<uint64_t, 64>>());
+    if (dtype_name == "rec128") return visit(dtype_tag<record<uint64_t, 128>>());
+    return dispatch_dtype(dtype_name, visit);
+}
+
+/*
+* kmerge_min_block - smallest run block, KMERGE_MIN_BLOCK keeps reads
+*                    large, a -b budget too small for KMERGE_MIN_FAN_IN
+*                    runs of that size shrinks the block instead, so the
+*                    merge stays within the budget and keeps its fan in
+*/
+#define KMERGE_MIN_BLOCK (1 << 14)
+#define KMERGE_MIN_FAN_IN 16
+
+inline size_t kmerge_min_block(const size_t& buf_size)
+{
+    return std::max(std::min(buf_size / (KMERGE_MIN_FAN_IN + 1), (size_t)KMERGE_MIN_BLOCK), (size_t)1);
+}
+
+/*
+* kmerge_block_size - elements per run block, the -b buffer is shared
+*                     by k input blocks and 1 output block, but never
+*                     goes below kmerge_min_block
+*/
+inline size_t kmerge_block_size(const size_t& buf_size, const size_t& run_cnt)
+{
+    return std::max(buf_size / (run_cnt + 1), kmerge_min_block(buf_size));
+}
+
+/*
+* kmerge_fan_in - most runs merged at once, bounded both by the memory
+*                 budget (every run keeps a full kmerge_min_block) and
+*                 by the open file limit minus KMERGE_FD_RESERVE
+*/
+#define KMERGE_FD_RESERVE 64
+
+inline size_t kmerge_fan_in(const size_t& buf_size)
+{
+    size_t mem_fan_in = buf_size / kmerge_min_block(buf_size);
+    mem_fan_in = mem_fan_in > 1 ? mem_fan_in - 1 : 0; // one block for output
+
+    size_t fd_fan_in = mem_fan_in;
+    struct rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY)
+        fd_fan_in = fd_limit.rlim_cur > KMERGE_FD_RESERVE ? fd_limit.rlim_cur - KMERGE_FD_RESERVE : 0;
+
+    return std::max(std::min(mem_fan_in, fd_fan_in), (size_t)2);
+}
+
+/*
+* single merge pass over all of input_file_list
+*
+* buf_size - total element budget for the merge, see kmerge_block_size
+* selector - heap or loser_tree, anything constructible from the head
+*            list that offers top/replace_top/pop/empty, with inlined
+*            comparators the loser tree measures faster in bench_losertree
+*            from a few dozen runs up, which is where kmerge_file's fan-in
+*            usually sits
+* writer - output constructed from (path, block size) with put/close,
+*          e.g. index_writer to split indexed elements on the way out
+*/
+template<typename dtype, template<typename, typename> class selector = loser_tree, typename writer = block_writer<dtype>>
+void kmerge_pass(
     std::vector<std::string> input_file_list,
-    std::string output_file_path
+    std::string output_file_path,
+    const size_t& buf_size
 )
 {
-    std::function<
-        bool(
-            const std::pair<std::shared_ptr<std::ifstream>, dtype>&,
-            const std::pair<std::shared_ptr<std::ifstream>, dtype>&
-        )
-    > cmpt = [](
-        const std::pair<std::shared_ptr<std::ifstream>, dtype>& fp1,
-        const std::pair<std::shared_ptr<std::ifstream>, dtype>& fp2
+    typedef typename sort_key<dtype>::key_type key_type;
+    sort_key<dtype> key_of;
+
+    // selector holds the head key and the index of its run, the head
+    // element itself stays in head_list, so neither a stream handle nor
+    // a record payload is copied in and out of the selector
+    auto cmpt = [](
+        const std::pair<key_type, int>& fp1,
+        const std::pair<key_type, int>& fp2
     ) {
-        return fp1.second > fp2.second; // ascend heap, not descend heap
+        return fp1.first > fp2.first; // ascend order, not descend order
     };
-    heap<std::pair<std::shared_ptr<std::ifstream>, dtype>, decltype(cmpt)> ksegheap(cmpt);
 
-    for (const std::string input_file_path : input_file_list)
+    size_t block_size = kmerge_block_size(buf_size, input_file_list.size());
+    std::vector<block_reader<dtype>> run_list;
+    std::vector<dtype> head_list(input_file_list.size());
+    std::vector<std::pair<key_type, int>> key_list;
+    run_list.reserve(input_file_list.size());
+    for (const std::string& input_file_path : input_file_list)
     {
-        std::shared_ptr<std::ifstream> finput = std::make_shared<std::ifstream>(
-            input_file_path, std::ifstream::binary
-        );
-        if (!finput->is_open()) {
+        run_list.emplace_back(input_file_path, block_size);
+        if (!run_list.back().is_open()) {
             fprintf(stderr, "failed to open %s\n", input_file_path.c_str());
             continue;
         }
 
-        dtype finput_head;
-        finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(dtype));
-        if (finput->gcount() == 0)
+        int run_idx = (int)run_list.size() - 1;
+        if (!run_list.back().next(head_list[run_idx]))
             continue;
-        // can't use std::pair<type1, type2> to construct
-        // there is no such constructor for std::pair
-        ksegheap.push(std::make_pair(finput, finput_head));
+        key_list.emplace_back(key_of(head_list[run_idx]), run_idx);
     }
+    selector<std::pair<key_type, int>, decltype(cmpt)> ksegtree(cmpt, std::move(key_list));
 
-    std::ofstream foutput(output_file_path, std::ofstream::binary);
-    std::filesystem::create_directories(std::filesystem::path(output_file_path).parent_path());
+    std::filesystem::path output_parent = std::filesystem::path(output_file_path).parent_path();
+    if (!output_parent.empty())
+        std::filesystem::create_directories(output_parent);
+    writer foutput(output_file_path, block_size);
     if (!foutput.is_open())
     {
         fprintf(stderr, "failed to open kmerge file output file %s\n", output_file_path.c_str());
         exit(4);
     }
 
-    while (!ksegheap.empty())
+    while (!ksegtree.empty())
     {
-        auto [finput, finput_head] = ksegheap.top();
-        ksegheap.pop();
-        foutput.write(reinterpret_cast<char*>(&finput_head), 1 * sizeof(dtype));
+        int run_idx = ksegtree.top().second;
+        dtype& finput_head = head_list[run_idx];
+        foutput.put(finput_head);
 
-        finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(dtype));
-        if (finput->gcount() == 0)
-            finput->close();
+        if (run_list[run_idx].next(finput_head))
+            ksegtree.replace_top(std::make_pair(key_of(finput_head), run_idx));
         else
-            ksegheap.push(std::make_pair(finput, finput_head));
+            ksegtree.pop();
     }
     foutput.close();
 }
 
 
+// data/node/<proc_mark>/seg/<seg_idx>.bin
+inline std::filesystem::path segment_path(const int& proc_mark, const int& seg_idx)
+{
+    return std::filesystem::path("data/node") / std::to_string(proc_mark) / "seg" / (std::to_string(seg_idx) + std::string(".bin"));
+}
+
 /*
-* internal_buf_size - vector size for external sort
+* dump one sorted chunk as segment seg_idx
+*/
+template<typename dtype>
+bool dump_segment(
+    const dtype* data,
+    const size_t& item_cnt,
+    const int& proc_mark,
+    const int& seg_idx
+)
+{
+    std::filesystem::path output_path = segment_path(proc_mark, seg_idx);
+    std::filesystem::create_directories(output_path.parent_path());
+    std::ofstream foutput(output_path, std::ofstream::binary);
+    if (!foutput.is_open())
+    {
+        fprintf(stderr, "node%d failed to dump sorted sub-segment %d\n", proc_mark, seg_idx);
+        return false;
+    }
+
+    foutput.write(reinterpret_cast<const char*>(data), sizeof(dtype) * item_cnt);
+    foutput.close();
+    return true;
+}
+
+/*
+* multithreaded run generation, the calling thread keeps reading the
+* next chunk while sort_threads workers sort and dump the chunks read
+* before it, internal_buf_size is shared by the sort_threads + 1 chunk
+* buffers and, with radix sort, one scratch buffer per worker
+*
+* return the number of segments dumped
+*/
+template<typename dtype>
+int parallel_runs(
+    std::ifstream& finput,
+    const size_t& internal_buf_size,
+    const int& proc_mark,
+    const int& sort_threads
+)
+{
+    struct chunk
+    {
+        int buf_idx;
+        int seg_idx;
+        size_t item_cnt;
+    };
+
+    size_t chunk_size = run_chunk_size<dtype>(internal_buf_size, sort_threads + 1, sort_threads);
+    std::vector<std::vector<dtype>> buf_pool(sort_threads + 1, std::vector<dtype>(chunk_size));
+    blocking_queue<int> free_list;  // buffers ready to be read into
+    blocking_queue<chunk> fill_list; // chunks waiting to be sorted
+    for (size_t i = 0; i < buf_pool.size(); ++i)
+        free_list.push((int)i);
+
+    std::vector<std::thread> worker_list;
+    for (int i = 0; i < sort_threads; ++i)
+    {
+        worker_list.emplace_back([&]() {
+            chunk task;
+            std::vector<dtype> scratch; // private to each worker
+            while (fill_list.pop(task))
+            {
+                std::vector<dtype>& rx_buf = buf_pool[task.buf_idx];
+                sort_run<dtype>(rx_buf.data(), rx_buf.data() + task.item_cnt, scratch);
+                if (!dump_segment<dtype>(rx_buf.data(), task.item_cnt, proc_mark, task.seg_idx))
+                    exit(1);
+                free_list.push(task.buf_idx);
+            }
+        });
+    }
+
+    int seg_cnt = 0;
+    size_t rx_cnt;
+    do {
+        int buf_idx;
+        free_list.pop(buf_idx);
+        finput.read(reinterpret_cast<char*>(buf_pool[buf_idx].data()), sizeof(dtype) * chunk_size);
+        rx_cnt = finput.gcount() / sizeof(dtype);
+        if (rx_cnt == 0) break;
+
+        fill_list.push(chunk{buf_idx, seg_cnt, rx_cnt});
+        seg_cnt++;
+    } while (rx_cnt == chunk_size);
+    fill_list.close();
+
+    for (std::thread& worker : worker_list)
+        worker.join();
+    return seg_cnt;
+}
+
+/*
+* external merge of any number of runs, when there are more runs than
+* kmerge_fan_in allows, the smallest runs are merged first into
+* temporary runs next to the output, the first merge takes just enough
+* runs for every later one to be a full fan-in merge, which minimizes
+* the total bytes re-read (optimal merge pattern)
+*
+* writer - output of the last pass only, temporary runs stay dtype
+*
+* return the number of merge passes the deepest data went through
+*/
+template<typename dtype, template<typename, typename> class selector = loser_tree, typename writer = block_writer<dtype>>
+int kmerge_file(
+    std::vector<std::string> input_file_list,
+    std::string output_file_path,
+    const size_t& buf_size
+)
+{
+    struct run_info
+    {
+        std::string path;
+        size_t bytes;
+        int level; // merge passes this run has gone through
+        bool temp;
+    };
+
+    auto cmpt = [](const run_info& fp1, const run_info& fp2) {
+        return fp1.bytes > fp2.bytes; // smallest run on top
+    };
+    heap<run_info, decltype(cmpt)> runheap(cmpt, input_file_list.size());
+    for (const std::string& input_file_path : input_file_list)
+    {
+        std::error_code ec;
+        size_t bytes = std::filesystem::file_size(input_file_path, ec);
+        runheap.emplace(run_info{input_file_path, ec ? 0 : bytes, 0, false});
+    }
+
+    size_t fan_in = kmerge_fan_in(buf_size);
+    size_t take = runheap.size() > fan_in ? (runheap.size() - 2) % (fan_in - 1) + 2 : runheap.size();
+    std::filesystem::path temp_dir = std::filesystem::path(output_file_path).parent_path();
+    int step = 0;
+    while (runheap.size() > fan_in)
+    {
+        std::vector<run_info> merge_list;
+        for (size_t i = 0; i < take; ++i)
+        {
+            merge_list.emplace_back(runheap.top());
+            runheap.pop();
+        }
+
+        run_info merged{(temp_dir / ("kmerge_" + std::to_string(step++) + ".bin")).string(), 0, 0, true};
+        std::vector<std::string> merge_path_list;
+        for (const run_info& run : merge_list)
+        {
+            merge_path_list.emplace_back(run.path);
+            merged.bytes += run.bytes;
+            merged.level = std::max(merged.level, run.level + 1);
+        }
+        kmerge_pass<dtype, selector>(merge_path_list, merged.path, buf_size);
+
+        for (const run_info& run : merge_list)
+            if (run.temp) std::filesystem::remove(run.path);
+        runheap.push(merged);
+        take = fan_in;
+    }
+
+    // last pass writes the output
+    int pass_cnt = 1;
+    std::vector<std::string> merge_path_list;
+    std::vector<std::string> temp_path_list;
+    while (!runheap.empty())
+    {
+        const run_info& run = runheap.top();
+        merge_path_list.emplace_back(run.path);
+        if (run.temp) temp_path_list.emplace_back(run.path);
+        pass_cnt = std::max(pass_cnt, run.level + 1);
+        runheap.pop();
+    }
+    kmerge_pass<dtype, selector, writer>(merge_path_list, output_file_path, buf_size);
+    for (const std::string& temp_path : temp_path_list)
+        std::filesystem::remove(temp_path);
+
+    return pass_cnt;
+}
+
+/*
+* replacement selection run generation, a heap of internal_buf_size
+* elements tagged with their run number keeps emitting the smallest
+* element that still fits the current run, on random input the runs
+* average 2 * internal_buf_size and presorted input yields a single run
+*
+* return the number of segments dumped
+*/
+template<typename dtype>
+int replacement_runs(
+    std::ifstream& finput,
+    const size_t& internal_buf_size,
+    const int& proc_mark
+)
+{
+    // (run, value), smaller run first and then smaller key
+    key_less<dtype> less;
+    auto cmpt = [less](
+        const std::pair<int, dtype>& fp1,
+        const std::pair<int, dtype>& fp2
+    ) {
+        return fp1.first > fp2.first || (fp1.first == fp2.first && less(fp2.second, fp1.second));
+    };
+    heap<std::pair<int, dtype>, decltype(cmpt)> runheap(cmpt, internal_buf_size);
+
+    // input is still read in blocks, not element by element
+    std::vector<dtype> rx_buf(std::min(internal_buf_size, (size_t)KMERGE_MIN_BLOCK));
+    size_t rx_cnt = 0;
+    size_t rx_pos = 0;
+    auto next_input = [&](dtype& value) {
+        if (rx_pos == rx_cnt)
+        {
+            finput.read(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * rx_buf.size());
+            rx_cnt = finput.gcount() / sizeof(dtype);
+            rx_pos = 0;
+            if (rx_cnt == 0) return false;
+        }
+        value = rx_buf[rx_pos++];
+        return true;
+    };
+
+    dtype value;
+    while (runheap.size() < internal_buf_size && next_input(value))
+        runheap.emplace(0, value);
+    if (runheap.empty())
+        return 0;
+
+    std::filesystem::create_directories(segment_path(proc_mark, 0).parent_path());
+    std::unique_ptr<block_writer<dtype>> foutput;
+    int seg_cnt = 0;
+    while (!runheap.empty())
+    {
+        auto& [run_idx, head] = runheap.top();
+        if (!foutput || run_idx == seg_cnt)
+        {
+            // current run can not be extended any more, start the next
+            foutput = std::make_unique<block_writer<dtype>>(segment_path(proc_mark, run_idx).string(), KMERGE_MIN_BLOCK);
+            if (!foutput->is_open())
+            {
+                fprintf(stderr, "node%d failed to dump sorted sub-segment %d\n", proc_mark, run_idx);
+                exit(1);
+            }
+            seg_cnt = run_idx + 1;
+        }
+        foutput->put(head);
+
+        if (next_input(value))
+        {
+            // smaller than what was just written, must wait for next run
+            if (less(value, head)) run_idx++;
+            head = value;
+            runheap.sift_top();
+        }
+        else
+            runheap.pop();
+    }
+    foutput->close();
+    return seg_cnt;
+}
+
+/*
+* internal_buf_size - element budget of run generation and of the merge
 * proc_mark - used for MPI environment
-* keep_size - number of items will actually be saved to file, -1 for all
-* sort_order - 0: ascend, 1: descend
-* save_order - 0: ascend, 1: descend
+* sort_threads - number of threads generating sorted runs, 1 keeps the
+*                plain read-sort-dump loop on the calling thread
+* replace_select - form runs by replacement selection instead of fixed
+*                  chunks, takes precedence over sort_threads
+*
+* return the number of merge passes, see kmerge_file
 */
 template<typename dtype>
-void sort_file(
+int sort_file(
     std::string input_file_path,
     std::string output_file_path,
-    const int& internal_buf_size,
-    const int& proc_mark
+    const size_t& internal_buf_size,
+    const int& proc_mark,
+    const int& sort_threads = 1,
+    const bool& replace_select = false
 )
 {
     // some data variables
@@ -138,41 +529,44 @@ void sort_file(
     }
 
     // distribute to segments
-    std::vector<dtype> rx_buf(internal_buf_size);
-    std::filesystem::path base = "data/node";
     int seg_cnt = 0;
-    int rx_cnt;
-    do {
-        finput.read(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * internal_buf_size);
-        rx_cnt = finput.gcount() / sizeof(dtype);
-        if (rx_cnt == 0) break;
-
-        std::sort(rx_buf.begin(), rx_buf.begin() + rx_cnt);
-
-        std::filesystem::path output_path = base / std::to_string(proc_mark) / "seg" / (std::to_string(seg_cnt) + std::string(".bin"));
-        std::filesystem::create_directories(output_path.parent_path());
-        std::ofstream foutput(output_path, std::ofstream::binary);
-        if (!foutput.is_open())
-        {
-            fprintf(stderr, "node%d failed to dump sorted sub-segment %d", proc_mark, seg_cnt);
-            continue;
-        }
-
-        foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * rx_cnt);
-        foutput.close();
-
-        seg_cnt++;
-    } while (rx_cnt == internal_buf_size);
+    if (replace_select)
+    {
+        seg_cnt = replacement_runs<dtype>(finput, internal_buf_size, proc_mark);
+    }
+    else if (sort_threads > 1)
+    {
+        seg_cnt = parallel_runs<dtype>(finput, internal_buf_size, proc_mark, sort_threads);
+    }
+    else
+    {
+        // the radix scratch buffer comes out of the same budget
+        size_t chunk_size = run_chunk_size<dtype>(internal_buf_size, 1, 1);
+        std::vector<dtype> rx_buf(chunk_size);
+        std::vector<dtype> scratch;
+        size_t rx_cnt;
+        do {
+            finput.read(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * chunk_size);
+            rx_cnt = finput.gcount() / sizeof(dtype);
+            if (rx_cnt == 0) break;
+
+            sort_run<dtype>(rx_buf.data(), rx_buf.data() + rx_cnt, scratch);
+            // a lost run would silently drop data, fail like the workers do
+            if (!dump_segment<dtype>(rx_buf.data(), rx_cnt, proc_mark, seg_cnt))
+                exit(1);
+
+            seg_cnt++;
+        } while (rx_cnt == chunk_size);
+    }
     finput.close();
 
     // merge segments
     std::vector<std::string> input_file_list;
     for (int i = 0; i < seg_cnt; ++i)
     {
-        std::filesystem::path input_path = base / std::to_string(proc_mark) / "seg" / (std::to_string(i) + std::string(".bin"));
-        input_file_list.emplace_back(input_path.string());
+        input_file_list.emplace_back(segment_path(proc_mark, i).string());
     }
-    kmerge_file<dtype>(input_file_list, output_file_path);
+    return kmerge_file<dtype>(input_file_list, output_file_path, internal_buf_size);
 }
 
 void c_truncate(
@@ -0,0 +1,454 @@
+#ifndef COMMON_MPI_H
+#define COMMON_MPI_H
+
+#include <common_cpp.h>
+#include <mpi/mpi.h>
+
+/*
+* mpi_type - MPI datatype matching an element type, one specialization
+*            for every type dispatch_dtype can pick
+*/
+template<typename dtype>
+struct mpi_type;
+
+template<> struct mpi_type<int32_t>  { static MPI_Datatype get() { return MPI_INT32_T; } };
+template<> struct mpi_type<int64_t>  { static MPI_Datatype get() { return MPI_INT64_T; } };
+template<> struct mpi_type<uint32_t> { static MPI_Datatype get() { return MPI_UINT32_T; } };
+template<> struct mpi_type<uint64_t> { static MPI_Datatype get() { return MPI_UINT64_T; } };
+template<> struct mpi_type<float>    { static MPI_Datatype get() { return MPI_FLOAT; } };
+template<> struct mpi_type<double>   { static MPI_Datatype get() { return MPI_DOUBLE; } };
+
+/*
+* a record travels as one derived datatype, the key keeps its own MPI type
+* and the payload is moved as a single block of bytes, the extent is
+* resized to sizeof(record) so arrays of records stride correctly, the
+* type is built on first use (after MPI_Init) and lives until finalize
+*/
+template<typename key_t, size_t record_bytes>
+struct mpi_type<record<key_t, record_bytes>>
+{
+    static MPI_Datatype get()
+    {
+        static MPI_Datatype type = create();
+        return type;
+    }
+
+private:
+    static MPI_Datatype create()
+    {
+        typedef record<key_t, record_bytes> rtype;
+        int block_len[2] = {1, (int)sizeof(rtype::payload)};
+        MPI_Aint disp[2] = {offsetof(rtype, key), offsetof(rtype, payload)};
+        MPI_Datatype field_type[2] = {mpi_type<key_t>::get(), MPI_BYTE};
+
+        MPI_Datatype packed, type;
+        MPI_Type_create_struct(2, block_len, disp, field_type, &packed);
+        MPI_Type_create_resized(packed, 0, sizeof(rtype), &type);
+        MPI_Type_commit(&type);
+        MPI_Type_free(&packed);
+        return type;
+    }
+};
+
+/*
+* an indexed element is its value followed by the 64-bit position, resized
+* to sizeof(indexed) like the record type above
+*/
+template<typename dtype>
+struct mpi_type<indexed<dtype>>
+{
+    static MPI_Datatype get()
+    {
+        static MPI_Datatype type = create();
+        return type;
+    }
+
+private:
+    static MPI_Datatype create()
+    {
+        typedef indexed<dtype> itype;
+        int block_len[2] = {1, 1};
+        MPI_Aint disp[2] = {offsetof(itype, value), offsetof(itype, idx)};
+        MPI_Datatype field_type[2] = {mpi_type<dtype>::get(), MPI_UINT64_T};
+
+        MPI_Datatype packed, type;
+        MPI_Type_create_struct(2, block_len, disp, field_type, &packed);
+        MPI_Type_create_resized(packed, 0, sizeof(itype), &type);
+        MPI_Type_commit(&type);
+        MPI_Type_free(&packed);
+        return type;
+    }
+};
+
+/*
+* mpi_init_funneled - MPI_Init for the engines that run threads next to MPI
+*                     (-j sort workers, the psrs exchange writer), only the
+*                     main thread ever calls MPI, aborts when the library
+*                     can not promise that much thread support
+*/
+inline void mpi_init_funneled(int* argc, char*** argv)
+{
+    int provided;
+    MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        int world_rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+        if (world_rank == 0)
+            fprintf(stderr, "MPI library provides thread level %d, need MPI_THREAD_FUNNELED\n", provided);
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+}
+
+/*
+* parallel_read - every rank reads its own contiguous share of the input
+*                 file at the same time through MPI-IO and dumps it to
+*                 output_path, no rank works as a funnel
+* buf_size - number of elements read per call
+* attach_index - dump indexed<dtype> elements that carry their position
+*                in the input file instead of plain values
+* return number of elements this rank got
+*/
+template<typename dtype>
+size_t parallel_read(
+    const char* input_path,
+    const std::string& output_path,
+    const MPI_Datatype& mpi_type,
+    const int& buf_size,
+    MPI_Comm comm = MPI_COMM_WORLD,
+    const bool& attach_index = false
+) {
+    int comm_size, comm_rank;
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_rank(comm, &comm_rank);
+
+    MPI_File finput;
+    if (MPI_File_open(comm, input_path, MPI_MODE_RDONLY, MPI_INFO_NULL, &finput) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "failed to open input data bin %s\n", input_path);
+        MPI_Abort(comm, 1);
+    }
+
+    std::filesystem::create_directories(std::filesystem::path(output_path).parent_path());
+    std::ofstream foutput(output_path, std::ofstream::binary);
+    if (!foutput.is_open())
+    {
+        fprintf(stderr, "failed to open %s\n", output_path.c_str());
+        MPI_Abort(comm, 2);
+    }
+
+    // rank i owns elements [item_cnt * i / P, item_cnt * (i + 1) / P)
+    MPI_Offset bytes;
+    MPI_File_get_size(finput, &bytes);
+    size_t item_cnt = bytes / sizeof(dtype);
+    size_t first = item_cnt * comm_rank / comm_size;
+    size_t last = item_cnt * (comm_rank + 1) / comm_size;
+
+    // every share is one large contiguous range, independent reads avoid
+    // the two-phase shuffle of collective buffering
+    std::vector<dtype> buf(buf_size);
+    std::vector<indexed<dtype>> tagged(attach_index ? buf_size : 0);
+    while (first < last)
+    {
+        int read_cnt = std::min<size_t>(buf_size, last - first);
+        MPI_File_read_at(
+            finput, (MPI_Offset)(first * sizeof(dtype)),
+            buf.data(), read_cnt, mpi_type, MPI_STATUS_IGNORE
+        );
+        if (attach_index)
+        {
+            // the position is known right here, tag before the dump
+            for (int i = 0; i < read_cnt; ++i)
+                tagged[i] = indexed<dtype>{buf[i], first + i};
+            foutput.write(reinterpret_cast<char*>(tagged.data()), sizeof(indexed<dtype>) * read_cnt);
+        }
+        else
+            foutput.write(reinterpret_cast<char*>(buf.data()), sizeof(dtype) * read_cnt);
+        first += read_cnt;
+    }
+
+    MPI_File_close(&finput);
+    foutput.close();
+    return item_cnt * (comm_rank + 1) / comm_size - item_cnt * comm_rank / comm_size;
+}
+
+/*
+* parallel_write - every rank writes its local sorted partition straight
+*                  into one shared output file, ranks are laid out in rank
+*                  order at offsets from an exclusive prefix sum of sizes
+* buf_size - number of elements written per collective call
+* return global offset in elements of this rank's partition
+*/
+template<typename dtype>
+size_t parallel_write(
+    const std::string& input_path,
+    const char* output_path,
+    const MPI_Datatype& mpi_type,
+    const int& buf_size,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    int comm_rank;
+    MPI_Comm_rank(comm, &comm_rank);
+
+    std::ifstream finput(input_path, std::ifstream::binary);
+    if (!finput.is_open())
+    {
+        fprintf(stderr, "failed to open %s\n", input_path.c_str());
+        MPI_Abort(comm, 1);
+    }
+
+    uint64_t local_cnt = std::filesystem::file_size(input_path) / sizeof(dtype);
+    uint64_t global_off = 0;
+    uint64_t global_cnt = 0;
+    MPI_Exscan(&local_cnt, &global_off, 1, MPI_UINT64_T, MPI_SUM, comm);
+    if (comm_rank == 0)
+        global_off = 0; // exscan leaves rank 0 undefined
+    MPI_Allreduce(&local_cnt, &global_cnt, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    MPI_File foutput;
+    if (MPI_File_open(comm, output_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &foutput) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "failed to open output %s\n", output_path);
+        MPI_Abort(comm, 2);
+    }
+    // drop whatever a previous, longer result left behind
+    MPI_File_set_size(foutput, (MPI_Offset)(global_cnt * sizeof(dtype)));
+
+    // collective writes need the same call count on every rank
+    uint64_t round_cnt = 0;
+    uint64_t local_round = (local_cnt + buf_size - 1) / buf_size;
+    MPI_Allreduce(&local_round, &round_cnt, 1, MPI_UINT64_T, MPI_MAX, comm);
+
+    std::vector<dtype> buf(buf_size);
+    uint64_t offset = global_off;
+    for (uint64_t round = 0; round < round_cnt; ++round)
+    {
+        finput.read(reinterpret_cast<char*>(buf.data()), sizeof(dtype) * buf_size);
+        int write_cnt = finput.gcount() / sizeof(dtype);
+        MPI_File_write_at_all(
+            foutput, (MPI_Offset)(offset * sizeof(dtype)),
+            buf.data(), write_cnt, mpi_type, MPI_STATUS_IGNORE
+        );
+        offset += write_cnt;
+    }
+
+    MPI_File_close(&foutput);
+    finput.close();
+    return global_off;
+}
+
+struct exchange_stat
+{
+    std::vector<uint64_t> recv_tlt_list; // elements received from every rank
+    uint64_t round_cnt = 0;              // MPI_Ialltoallv rounds
+    double read_sec = 0.0;               // reading the sorted run
+    double wait_sec = 0.0;               // waiting on the network
+    double write_sec = 0.0;              // dumping or merging, overlapped
+    size_t spilled = 0;                  // elements the streaming merge spilled
+};
+
+/*
+* exchange_segments - psrs data exchange, segment i of the local sorted run
+*                     goes to rank i in rounds of MPI_Ialltoallv, a writer
+*                     thread dumps round r - 1 into node_dir/seg/<src>.bin
+*                     (or merges it into node_dir/merge.bin with stream_merge)
+*                     while round r is on the wire and round r + 1 is read,
+*                     only the calling thread makes MPI calls
+* seg_head - comm_size + 1 local bounds, segment i is
+*            [seg_head[i], seg_head[i + 1]), e.g. from tie_split_bounds
+* buf_size - element budget of the send and the receive buffers each
+* writer - output of the streaming merge
+*/
+template<typename etype, typename writer = block_writer<etype>>
+exchange_stat exchange_segments(
+    const run_view<etype>& sorted_run,
+    std::vector<size_t> seg_head,
+    const std::filesystem::path& node_dir,
+    const int& buf_size,
+    const bool& stream_merge,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    int comm_size, comm_rank;
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_rank(comm, &comm_rank);
+    exchange_stat stat;
+
+    std::vector<uint64_t> all_send_tlt(comm_size);
+    for (int i = 0; i < comm_size; ++i)
+        all_send_tlt[i] = seg_head[i + 1] - seg_head[i];
+
+    // broadcast the total receive amount to each node
+    std::vector<uint64_t> all_recv_tlt(comm_size);
+    MPI_Alltoall(
+        all_send_tlt.data(), 1, MPI_UINT64_T,
+        all_recv_tlt.data(), 1, MPI_UINT64_T,
+        comm
+    );
+    stat.recv_tlt_list = all_recv_tlt;
+
+    // send and recv buffers are double buffered, so one round costs at
+    // most buf_size elements for each direction
+    const int pipe_depth = 2;
+    // every count and displacement of one round stays below buf_size, so
+    // partitions beyond 2^31 elements only add rounds, never overflow an
+    // int argument of MPI_Ialltoallv
+    int max_seg_len = std::max(1, buf_size / comm_size / pipe_depth);
+    std::vector<int> buf_offset(comm_size);
+    for (int i = 0; i < comm_size; ++i)
+        buf_offset[i] = i * max_seg_len;
+
+    // amount moved between two nodes in a round only depends on the
+    // totals, so the per-round counts need no extra MPI_Alltoall
+    auto round_len = [&](const uint64_t& total, const uint64_t& round) -> int {
+        uint64_t done = round * max_seg_len;
+        return total > done ? (int)std::min<uint64_t>(max_seg_len, total - done) : 0;
+    };
+    {
+        uint64_t longest = std::max(
+            *std::max_element(all_send_tlt.begin(), all_send_tlt.end()),
+            *std::max_element(all_recv_tlt.begin(), all_recv_tlt.end())
+        );
+        uint64_t local_cnt = (longest + max_seg_len - 1) / max_seg_len;
+        MPI_Allreduce(&local_cnt, &stat.round_cnt, 1, MPI_UINT64_T, MPI_MAX, comm);
+    }
+
+    std::filesystem::path seg_dir = node_dir / "seg";
+    std::filesystem::remove_all(seg_dir); // in case some other function create files with same name
+    std::filesystem::create_directories(seg_dir);
+    if (!std::filesystem::exists(seg_dir))
+    {
+        fprintf(stderr, "node%d failed to create segment dir\n", comm_rank);
+        MPI_Abort(comm, 2);
+    }
+
+    std::vector<std::vector<etype>> send_pool(pipe_depth, std::vector<etype>(max_seg_len * comm_size));
+    std::vector<std::vector<etype>> recv_pool(pipe_depth, std::vector<etype>(max_seg_len * comm_size));
+    std::vector<std::vector<int>> send_cnt_pool(pipe_depth, std::vector<int>(comm_size));
+    std::vector<std::vector<int>> recv_cnt_pool(pipe_depth, std::vector<int>(comm_size));
+    blocking_queue<int> free_list; // recv buffers ready for the next round
+    blocking_queue<int> fill_list; // recv buffers waiting to be dumped
+    for (int slot = 0; slot < pipe_depth; ++slot)
+        free_list.push(slot);
+
+    // either one persistent writer per source, files are preallocated
+    // from the totals exchanged above, or a merger that turns the
+    // incoming sorted streams into merge.bin without segment files
+    std::vector<size_t> recv_tlt_list(all_recv_tlt.begin(), all_recv_tlt.end());
+    size_t block_size = std::max<size_t>(max_seg_len, KMERGE_MIN_BLOCK);
+    std::unique_ptr<segment_sink<etype>> sink;
+    std::unique_ptr<stream_merger<etype, writer>> merger;
+    if (stream_merge)
+    {
+        size_t spill_cap = std::max<size_t>(buf_size / comm_size, max_seg_len);
+        merger.reset(new stream_merger<etype, writer>(node_dir / "merge.bin", seg_dir, recv_tlt_list, spill_cap, block_size));
+    }
+    else
+        sink.reset(new segment_sink<etype>(seg_dir.string(), recv_tlt_list, block_size));
+    if (stream_merge ? !merger->is_open() : !sink->is_open())
+    {
+        fprintf(stderr, "node%d failed to open segment file\n", comm_rank);
+        MPI_Abort(comm, 2);
+    }
+
+    // dump or merge received rounds while the next rounds are read and
+    // transferred
+    std::thread dumper([&]() {
+        int slot;
+        while (fill_list.pop(slot))
+        {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < comm_size; ++i)
+            {
+                if (stream_merge)
+                    merger->feed(i, recv_pool[slot].data() + buf_offset[i], recv_cnt_pool[slot][i]);
+                else
+                    sink->put(i, recv_pool[slot].data() + buf_offset[i], recv_cnt_pool[slot][i]);
+            }
+            auto t2 = std::chrono::high_resolution_clock::now();
+            stat.write_sec += std::chrono::duration<double>(t2 - t1).count();
+            free_list.push(slot);
+        }
+    });
+
+    auto fill_send = [&](const int& slot, const uint64_t& round) {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < comm_size; ++i)
+        {
+            int cnt = round_len(all_send_tlt[i], round);
+            send_cnt_pool[slot][i] = cnt;
+            sorted_run.read(seg_head[i], cnt, send_pool[slot].data() + buf_offset[i]);
+            seg_head[i] += cnt;
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        stat.read_sec += std::chrono::duration<double>(t2 - t1).count();
+    };
+
+    // round r is on the wire while round r + 1 is read from the sorted
+    // run and round r - 1 is written by the dumper thread
+    if (stat.round_cnt > 0)
+        fill_send(0, 0);
+    for (uint64_t round = 0; round < stat.round_cnt; ++round)
+    {
+        int send_slot = round % pipe_depth;
+        int recv_slot;
+        free_list.pop(recv_slot);
+        for (int i = 0; i < comm_size; ++i)
+            recv_cnt_pool[recv_slot][i] = round_len(all_recv_tlt[i], round);
+
+        MPI_Request request;
+        MPI_Ialltoallv(
+            send_pool[send_slot].data(), send_cnt_pool[send_slot].data(), buf_offset.data(), mpi_type<etype>::get(),
+            recv_pool[recv_slot].data(), recv_cnt_pool[recv_slot].data(), buf_offset.data(), mpi_type<etype>::get(),
+            comm, &request
+        );
+        if (round + 1 < stat.round_cnt)
+            fill_send((round + 1) % pipe_depth, round + 1);
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        stat.wait_sec += std::chrono::duration<double>(t2 - t1).count();
+        fill_list.push(recv_slot);
+    }
+    fill_list.close();
+    dumper.join();
+    if (stream_merge ? !merger->finish() : !sink->close())
+    {
+        fprintf(stderr, "node%d failed to write segment file\n", comm_rank);
+        MPI_Abort(comm, 2);
+    }
+    if (stream_merge)
+        stat.spilled = merger->spilled();
+    return stat;
+}
+
+/*
+* merge_segments - merge the node_dir/seg/<src>.bin files left by
+*                  exchange_segments into output_path
+* writer - output of the last merge pass
+* return the number of merge passes
+*/
+template<typename etype, typename writer = block_writer<etype>>
+int merge_segments(
+    const std::filesystem::path& node_dir,
+    const std::filesystem::path& output_path,
+    const size_t& buf_size,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    std::filesystem::path seg_dir = node_dir / "seg";
+    if (!std::filesystem::exists(seg_dir) || !std::filesystem::is_directory(seg_dir))
+    {
+        int comm_rank;
+        MPI_Comm_rank(comm, &comm_rank);
+        fprintf(stderr, "node%d not found segment dir\n", comm_rank);
+        MPI_Abort(comm, -1);
+    }
+
+    std::vector<std::string> input_file_list;
+    for (const auto& entry : std::filesystem::directory_iterator(seg_dir))
+        if (std::filesystem::is_regular_file(entry.status()))
+            input_file_list.emplace_back(entry.path().string());
+    return kmerge_file<etype, heap, writer>(input_file_list, output_path.string(), buf_size);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef LOSERTREE_H
+#define LOSERTREE_H
+
+#include <vector>
+#include <utility>
+using namespace std;
+
+/*
+* tournament tree of losers over k leaves, selection costs exactly
+* ceil(log2(k)) comparisons per replace_top/pop
+*
+* binary_op follows the same convention as heap: cmp(a, b) returns
+* true when b should be selected before a
+*/
+template <typename element, typename binary_op>
+class loser_tree
+{
+private:
+    vector<element> leaves;
+    vector<char> alive;   // leaf still holds a valid element
+    vector<size_t> tree;  // tree[0] the winner, tree[1..k-1] losers
+    binary_op cmp;
+    size_t leaf_cnt;
+    size_t live_cnt;
+
+private:
+    // whether leaf a wins against leaf b, exhausted leaves always lose
+    bool beats(size_t a, size_t b)
+    {
+        if (!alive[a]) return false;
+        if (!alive[b]) return true;
+        return !cmp(leaves[a], leaves[b]);
+    }
+
+    void build_tree()
+    {
+        tree.assign(leaf_cnt > 0 ? leaf_cnt : 1, 0);
+        if (leaf_cnt <= 1) return;
+
+        // winners of every subtree, leaf i sits on position leaf_cnt + i
+        vector<size_t> winner(leaf_cnt * 2);
+        for (size_t i = 0; i < leaf_cnt; ++i)
+            winner[leaf_cnt + i] = i;
+        for (size_t node = leaf_cnt - 1; node >= 1; --node)
+        {
+            size_t lson = winner[(node << 1) + 0];
+            size_t rson = winner[(node << 1) + 1];
+            if (beats(lson, rson))
+            {
+                winner[node] = lson;
+                tree[node] = rson;
+            }
+            else
+            {
+                winner[node] = rson;
+                tree[node] = lson;
+            }
+        }
+        tree[0] = winner[1];
+    }
+
+    // leaf has changed, play it against the losers on its path to root
+    void replay(size_t leaf)
+    {
+        size_t winner = leaf;
+        for (size_t node = (leaf_cnt + leaf) >> 1; node >= 1; node >>= 1)
+        {
+            if (beats(tree[node], winner))
+                swap(tree[node], winner);
+        }
+        tree[0] = winner;
+    }
+
+public:
+    loser_tree(binary_op opt, vector<element> init_list) : cmp(opt)
+    {
+        leaves = std::move(init_list);
+        leaf_cnt = leaves.size();
+        live_cnt = leaf_cnt;
+        alive.assign(leaf_cnt, 1);
+        build_tree();
+    }
+
+    size_t size() const
+    {
+        return live_cnt;
+    }
+
+    bool empty() const
+    {
+        return live_cnt == 0;
+    }
+
+    // index of the leaf currently selected
+    size_t top_index() const
+    {
+        return tree[0];
+    }
+
+    const element& top() const
+    {
+        return leaves[tree[0]];
+    }
+
+    // overwrite the selected leaf with its successor and reselect
+    void replace_top(const element& ele)
+    {
+        leaves[tree[0]] = ele;
+        replay(tree[0]);
+    }
+
+    void replace_top(element&& ele)
+    {
+        leaves[tree[0]] = std::move(ele);
+        replay(tree[0]);
+    }
+
+    // selected leaf has no successor, retire it
+    void pop()
+    {
+        if (!live_cnt) return;
+
+        alive[tree[0]] = 0;
+        live_cnt--;
+        replay(tree[0]);
+    }
+};
+
+#endif
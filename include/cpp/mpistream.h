@@ -0,0 +1,172 @@
+#ifndef MPISTREAM_H
+#define MPISTREAM_H
+
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <mpi/mpi.h>
+
+// a stream is a sequence of messages with one tag, every message but the
+// last carries exactly block_size elements and the last one carries fewer,
+// possibly none, so both ends must agree on block_size
+
+/*
+* mpi_stream_reader - element by element view of a stream sent by source,
+*                     the next block is already being received while the
+*                     current one is consumed
+*/
+template<typename dtype>
+class mpi_stream_reader
+{
+public:
+    mpi_stream_reader(
+        const int& source,
+        const int& tag,
+        const MPI_Datatype& mpi_type,
+        const size_t& block_size,
+        MPI_Comm comm = MPI_COMM_WORLD
+    ) : source(source), tag(tag), mpi_type(mpi_type), comm(comm),
+        block_size(block_size), cursor(0), length(0), pending(0), done(false)
+    {
+        block[0].resize(block_size);
+        block[1].resize(block_size);
+        post(0);
+    }
+
+    // a reader that still waits for its stream can not be dropped
+    mpi_stream_reader(const mpi_stream_reader&) = delete;
+    mpi_stream_reader(mpi_stream_reader&& other) = delete;
+
+    ~mpi_stream_reader()
+    {
+        if (!done)
+        {
+            MPI_Cancel(&request);
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+        }
+    }
+
+    bool next(dtype& value)
+    {
+        if (cursor == length && !fill())
+            return false;
+        value = block[1 - pending][cursor++];
+        return true;
+    }
+
+private:
+    void post(const int& slot)
+    {
+        MPI_Irecv(block[slot].data(), block_size, mpi_type, source, tag, comm, &request);
+        pending = slot;
+    }
+
+    bool fill()
+    {
+        if (done)
+            return false;
+
+        MPI_Status status;
+        int recv_cnt = 0;
+        MPI_Wait(&request, &status);
+        MPI_Get_count(&status, mpi_type, &recv_cnt);
+
+        // serve the block just received, ask for the following one
+        int ready = pending;
+        if ((size_t)recv_cnt == block_size)
+            post(1 - ready);
+        else
+        {
+            done = true;
+            pending = 1 - ready;
+        }
+        cursor = 0;
+        length = recv_cnt;
+        return length > 0;
+    }
+
+    int source;
+    int tag;
+    MPI_Datatype mpi_type;
+    MPI_Comm comm;
+    size_t block_size;
+
+    std::vector<dtype> block[2];
+    MPI_Request request;
+    size_t cursor;
+    size_t length;
+    int pending; // slot the outstanding receive writes to
+    bool done;
+};
+
+/*
+* mpi_stream_writer - element by element stream to dest, a full block is
+*                     sent without blocking while the other one refills
+*/
+template<typename dtype>
+class mpi_stream_writer
+{
+public:
+    mpi_stream_writer(
+        const int& dest,
+        const int& tag,
+        const MPI_Datatype& mpi_type,
+        const size_t& block_size,
+        MPI_Comm comm = MPI_COMM_WORLD
+    ) : dest(dest), tag(tag), mpi_type(mpi_type), comm(comm),
+        block_size(block_size), filling(0), length(0), closed(false)
+    {
+        block[0].resize(block_size);
+        block[1].resize(block_size);
+        request[0] = MPI_REQUEST_NULL;
+        request[1] = MPI_REQUEST_NULL;
+    }
+
+    mpi_stream_writer(const mpi_stream_writer&) = delete;
+    mpi_stream_writer(mpi_stream_writer&& other) = delete;
+
+    ~mpi_stream_writer()
+    {
+        close();
+    }
+
+    void put(const dtype& value)
+    {
+        block[filling][length++] = value;
+        if (length == block_size)
+            send();
+    }
+
+    // the short block ends the stream, an empty one if nothing is left
+    void close()
+    {
+        if (closed) return;
+        send();
+        MPI_Waitall(2, request, MPI_STATUSES_IGNORE);
+        closed = true;
+    }
+
+private:
+    void send()
+    {
+        MPI_Isend(block[filling].data(), length, mpi_type, dest, tag, comm, &request[filling]);
+        filling = 1 - filling;
+        length = 0;
+        MPI_Wait(&request[filling], MPI_STATUS_IGNORE); // previous send of this slot
+    }
+
+    int dest;
+    int tag;
+    MPI_Datatype mpi_type;
+    MPI_Comm comm;
+    size_t block_size;
+
+    std::vector<dtype> block[2];
+    MPI_Request request[2];
+    int filling; // slot put() writes to
+    size_t length;
+    bool closed;
+};
+
+#endif
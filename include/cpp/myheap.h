@@ -3,6 +3,7 @@
 
 #include <initializer_list>
 #include <vector>
+#include <utility>
 using namespace std;
 
 template <typename element, typename binary_op>
@@ -51,12 +52,17 @@ private:
     }
 
 public:
-    heap(binary_op opt)
+    heap(binary_op opt) : cmp(opt)
     {
         array.emplace_back(element()); // empty head
-        cmp = opt;
         heap_size = 0;
     }
+    // reserve room for capacity elements up front, so that pushing
+    // them does not go through repeated resize
+    heap(binary_op opt, size_t capacity) : heap(opt)
+    {
+        array.reserve(capacity + 1);
+    }
     heap(binary_op opt, std::initializer_list<element> init_list) : heap(opt)
     {
         heap_size = 0;
@@ -67,6 +73,16 @@ public:
         }
         build_heap();
     }
+    heap(binary_op opt, vector<element> init_list) : heap(opt, init_list.size())
+    {
+        heap_size = 0;
+        for (element& ele : init_list)
+        {
+            array.emplace_back(std::move(ele));
+            heap_size++;
+        }
+        build_heap();
+    }
 
     uint size() const
     {
@@ -74,11 +90,23 @@ public:
     }
 
     void push(const element& ele)
+    {
+        emplace(ele);
+    }
+
+    void push(element&& ele)
+    {
+        emplace(std::move(ele));
+    }
+
+    template <typename... args_t>
+    void emplace(args_t&&... args)
     {
         heap_size++;
         if (heap_size == array.size())
-            array.resize(heap_size * 2);
-        array[heap_size] = ele;
+            array.emplace_back(std::forward<args_t>(args)...);
+        else
+            array[heap_size] = element(std::forward<args_t>(args)...);
         sift_up(heap_size);
     }
 
@@ -86,15 +114,44 @@ public:
     {
         if (!heap_size) return;
 
-        swap(array[1], array[heap_size]);
+        if (heap_size > 1)
+            array[1] = std::move(array[heap_size]);
+        array[heap_size] = element(); // release what the slot holds
         heap_size--;
         sink_dn(1);
     }
 
-    element top()
+    // pop followed by push in a single sift-down
+    void replace_top(const element& ele)
+    {
+        if (!heap_size) return push(ele);
+        array[1] = ele;
+        sink_dn(1);
+    }
+
+    void replace_top(element&& ele)
+    {
+        if (!heap_size) return push(std::move(ele));
+        array[1] = std::move(ele);
+        sink_dn(1);
+    }
+
+    // restore the order after the top is modified in place through top()
+    void sift_top()
+    {
+        if (heap_size) sink_dn(1);
+    }
+
+    // the empty head is returned when there is no element
+    const element& top() const
+    {
+        return array[heap_size ? 1 : 0];
+    }
+
+    // mutable access to the top, must be followed by sift_top()
+    element& top()
     {
-        if (!heap_size) return element();
-        return array[1];
+        return array[heap_size ? 1 : 0];
     }
 
     bool empty() const
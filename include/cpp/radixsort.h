@@ -0,0 +1,177 @@
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include <sortkey.h>
+
+/*
+* radix_key - maps a value to an unsigned key with the same ordering
+*             so that lsd radix sort can work on its raw bits
+*/
+template<typename dtype>
+struct radix_key
+{
+    static constexpr bool enabled = false;
+};
+
+// signed integers flip the sign bit so negative values come first
+template<typename itype>
+struct radix_signed_key
+{
+    static constexpr bool enabled = true;
+    typedef typename std::make_unsigned<itype>::type key_type;
+
+    static key_type encode(const itype& value)
+    {
+        return (key_type)value ^ ((key_type)1 << (sizeof(key_type) * 8 - 1));
+    }
+};
+
+template<typename utype>
+struct radix_unsigned_key
+{
+    static constexpr bool enabled = true;
+    typedef utype key_type;
+
+    static key_type encode(const utype& value)
+    {
+        return value;
+    }
+};
+
+// negative floats flip every bit, positive floats flip the sign bit
+template<typename ftype, typename bits_type>
+struct radix_float_key
+{
+    static_assert(sizeof(ftype) == sizeof(bits_type), "float key size mismatch");
+    static constexpr bool enabled = true;
+    typedef bits_type key_type;
+
+    static key_type encode(const ftype& value)
+    {
+        constexpr key_type sign = (key_type)1 << (sizeof(key_type) * 8 - 1);
+        key_type bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return (bits & sign) ? ~bits : bits ^ sign;
+    }
+};
+
+template<> struct radix_key<int32_t>  : radix_signed_key<int32_t> {};
+template<> struct radix_key<int64_t>  : radix_signed_key<int64_t> {};
+template<> struct radix_key<uint32_t> : radix_unsigned_key<uint32_t> {};
+template<> struct radix_key<uint64_t> : radix_unsigned_key<uint64_t> {};
+template<> struct radix_key<float>    : radix_float_key<float, uint32_t> {};
+template<> struct radix_key<double>   : radix_float_key<double, uint64_t> {};
+
+/*
+* lsd radix sort with 8-bit digits on the sort_key of every element, one
+* histogram pass for all digits and one scatter pass per digit, passes
+* where every key shares the same digit are skipped, stable
+*
+* scratch - buffer of at least item_cnt elements
+*/
+template<typename dtype>
+void radix_sort(dtype* data, const size_t& item_cnt, dtype* scratch)
+{
+    typedef radix_key<typename sort_key<dtype>::key_type> rkey;
+    typedef typename rkey::key_type key_type;
+    constexpr int digit_bits = 8;
+    constexpr int digit_cnt = sizeof(key_type) * 8 / digit_bits;
+    constexpr size_t bucket_cnt = (size_t)1 << digit_bits;
+    constexpr key_type digit_mask = bucket_cnt - 1;
+    sort_key<dtype> key_of;
+
+    if (item_cnt < 2) return;
+
+    std::vector<size_t> hist(digit_cnt * bucket_cnt, 0);
+    for (size_t i = 0; i < item_cnt; ++i)
+    {
+        key_type key = rkey::encode(key_of(data[i]));
+        for (int d = 0; d < digit_cnt; ++d)
+            hist[d * bucket_cnt + ((key >> (d * digit_bits)) & digit_mask)]++;
+    }
+
+    dtype* src = data;
+    dtype* dst = scratch;
+    for (int d = 0; d < digit_cnt; ++d)
+    {
+        size_t* count = hist.data() + d * bucket_cnt;
+        int shift = d * digit_bits;
+        if (count[(rkey::encode(key_of(src[0])) >> shift) & digit_mask] == item_cnt)
+            continue;
+
+        // turn counts into the first output slot of each bucket
+        size_t offset = 0;
+        for (size_t b = 0; b < bucket_cnt; ++b)
+        {
+            size_t bucket_size = count[b];
+            count[b] = offset;
+            offset += bucket_size;
+        }
+        for (size_t i = 0; i < item_cnt; ++i)
+            dst[count[(rkey::encode(key_of(src[i])) >> shift) & digit_mask]++] = src[i];
+        std::swap(src, dst);
+    }
+    if (src != data)
+        std::copy(src, src + item_cnt, data);
+}
+
+/*
+* elements wider than this go to std::sort even when their key has a
+* radix_key, every radix pass moves whole elements and for wide records
+* that costs more than the comparisons saved, see bench_record
+*/
+#define RADIX_MAX_BYTES 8
+
+/*
+* radix_run - sort_run picks radix sort for dtype, that is USE_RADIX is on,
+*             the sort_key of dtype has a radix_key and dtype is at most
+*             RADIX_MAX_BYTES wide
+*/
+template<typename dtype>
+constexpr bool radix_run =
+#ifdef USE_RADIX
+    radix_key<typename sort_key<dtype>::key_type>::enabled && sizeof(dtype) <= RADIX_MAX_BYTES;
+#else
+    false;
+#endif
+
+/*
+* in-memory sort of one run, radix sort when radix_run<dtype>, otherwise
+* std::sort on the key
+*
+* scratch - grown on demand, reuse it across calls to avoid reallocation
+*/
+template<typename dtype>
+void sort_run(dtype* first, dtype* last, std::vector<dtype>& scratch)
+{
+    if constexpr (radix_run<dtype>)
+    {
+        size_t item_cnt = last - first;
+        if (scratch.size() < item_cnt)
+            scratch.resize(item_cnt);
+        radix_sort<dtype>(first, item_cnt, scratch.data());
+        return;
+    }
+    std::sort(first, last, key_less<dtype>());
+}
+
+/*
+* run_chunk_size - elements per in-memory run when buf_size is shared by
+*                  chunk_cnt chunk buffers and sorter_cnt concurrent
+*                  sort_run calls, each of which needs a scratch buffer as
+*                  large as its run when radix sort is picked
+*/
+template<typename dtype>
+size_t run_chunk_size(const size_t& buf_size, const size_t& chunk_cnt, const size_t& sorter_cnt)
+{
+    size_t share_cnt = chunk_cnt + (radix_run<dtype> ? sorter_cnt : 0);
+    return std::max(buf_size / share_cnt, (size_t)1);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sortkey.h>
+
+/*
+* record - fixed size element of record_bytes, a key followed by an
+*          opaque payload, records are ordered by key only and the
+*          payload is copied along as raw bytes
+*/
+template<typename key_t, size_t record_bytes>
+struct record
+{
+    static_assert(record_bytes > sizeof(key_t), "record has no room for a payload");
+
+    key_t key;
+    unsigned char payload[record_bytes - sizeof(key_t)];
+};
+
+template<typename key_t, size_t record_bytes>
+struct sort_key<record<key_t, record_bytes>>
+{
+    typedef key_t key_type;
+
+    const key_type& operator()(const record<key_t, record_bytes>& value) const
+    {
+        return value.key;
+    }
+
+    key_type& operator()(record<key_t, record_bytes>& value) const
+    {
+        return value.key;
+    }
+};
+
+/*
+* indexed - element tagged with its 64-bit position in the original
+*           input, ordered by the key of the element, used by argsort
+*/
+template<typename dtype>
+struct indexed
+{
+    dtype value;
+    uint64_t idx;
+};
+
+template<typename dtype>
+struct sort_key<indexed<dtype>>
+{
+    typedef typename sort_key<dtype>::key_type key_type;
+
+    const key_type& operator()(const indexed<dtype>& value) const
+    {
+        return sort_key<dtype>()(value.value);
+    }
+
+    key_type& operator()(indexed<dtype>& value) const
+    {
+        return sort_key<dtype>()(value.value);
+    }
+};
+
+#endif
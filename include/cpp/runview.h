@@ -0,0 +1,162 @@
+#ifndef RUNVIEW_H
+#define RUNVIEW_H
+
+#include <string>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sortkey.h>
+
+/*
+* run_view - read-only random access to a binary file of dtype elements
+*            without seek + read on a stream
+*
+* use_mmap - map the whole file and index it like an array, otherwise
+*            (or when mapping fails) every access is a pread on one fd
+*/
+template<typename dtype>
+class run_view
+{
+public:
+    run_view(const std::string& file_path, const bool& use_mmap = true)
+        : fd(-1), base(nullptr), bytes(0), item_cnt(0)
+    {
+        fd = open(file_path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close_fd();
+            return;
+        }
+        bytes = st.st_size;
+        item_cnt = bytes / sizeof(dtype);
+        if (!use_mmap || bytes == 0) return; // empty file can not be mapped
+
+        void* addr = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+            base = static_cast<const dtype*>(addr);
+    }
+
+    ~run_view()
+    {
+        if (base != nullptr)
+            munmap(const_cast<dtype*>(base), bytes);
+        close_fd();
+    }
+
+    run_view(const run_view&) = delete;
+    run_view& operator=(const run_view&) = delete;
+
+    bool is_open() const
+    {
+        return fd >= 0;
+    }
+
+    bool is_mapped() const
+    {
+        return base != nullptr;
+    }
+
+    // access pattern hint for the kernel, e.g. MADV_RANDOM, MADV_SEQUENTIAL
+    void advise(const int& advice) const
+    {
+        if (base != nullptr)
+            madvise(const_cast<dtype*>(base), bytes, advice);
+        else if (fd >= 0 && advice == MADV_SEQUENTIAL)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    size_t size() const
+    {
+        return item_cnt;
+    }
+
+    dtype at(const size_t& idx) const
+    {
+        dtype value;
+        read(idx, 1, &value);
+        return value;
+    }
+
+    // copy cnt elements starting at idx into dst, return the count copied
+    size_t read(const size_t& idx, const size_t& cnt, dtype* dst) const
+    {
+        if (base != nullptr)
+        {
+            std::copy(base + idx, base + idx + cnt, dst);
+            return cnt;
+        }
+
+        char* ptr = reinterpret_cast<char*>(dst);
+        size_t left = sizeof(dtype) * cnt;
+        off_t offset = sizeof(dtype) * idx;
+        while (left > 0)
+        {
+            ssize_t got = pread(fd, ptr, left, offset);
+            if (got <= 0) break;
+            ptr += got;
+            left -= got;
+            offset += got;
+        }
+        return cnt - left / sizeof(dtype);
+    }
+
+    // first index in [first, size()) whose key is greater than the key of
+    // value, the run must be sorted, costs O(log N) element reads
+    size_t upper_bound(const dtype& value, size_t first = 0) const
+    {
+        key_less<dtype> less;
+        if (base != nullptr)
+            return std::upper_bound(base + first, base + item_cnt, value, less) - base;
+        return search(first, [&](const dtype& ele) { return !less(value, ele); });
+    }
+
+    // first index in [first, size()) whose key is not less than value's
+    size_t lower_bound(const dtype& value, size_t first = 0) const
+    {
+        key_less<dtype> less;
+        if (base != nullptr)
+            return std::lower_bound(base + first, base + item_cnt, value, less) - base;
+        return search(first, [&](const dtype& ele) { return less(ele, value); });
+    }
+
+private:
+    // first index in [first, size()) where go_right turns false
+    template<typename predicate>
+    size_t search(size_t first, predicate go_right) const
+    {
+        size_t count = item_cnt - first;
+        while (count > 0)
+        {
+            size_t step = count / 2;
+            if (go_right(at(first + step)))
+            {
+                first += step + 1;
+                count -= step + 1;
+            }
+            else
+                count = step;
+        }
+        return first;
+    }
+
+    void close_fd()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    int fd;
+    const dtype* base;
+    size_t bytes;
+    size_t item_cnt;
+};
+
+#endif
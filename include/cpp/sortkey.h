@@ -0,0 +1,38 @@
+#ifndef SORTKEY_H
+#define SORTKEY_H
+
+/*
+* sort_key - key projection of an element, everything on the sort path
+*            (run sort, merges, splitters, run_view searches) orders
+*            elements by the key it returns, plain values are their own
+*            key and record types specialize it, the non-const overload
+*            lets splitter refinement move a pivot by its key alone
+*/
+template<typename dtype>
+struct sort_key
+{
+    typedef dtype key_type;
+
+    const key_type& operator()(const dtype& value) const
+    {
+        return value;
+    }
+
+    key_type& operator()(dtype& value) const
+    {
+        return value;
+    }
+};
+
+// ascending order of the projected keys
+template<typename dtype>
+struct key_less
+{
+    bool operator()(const dtype& lhs, const dtype& rhs) const
+    {
+        sort_key<dtype> key;
+        return key(lhs) < key(rhs);
+    }
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef SPLITTER_H
+#define SPLITTER_H
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+#include <mpi/mpi.h>
+#include <common_mpi.h>
+#include <runview.h>
+#include <sortkey.h>
+
+/*
+* regular_sample - sample_cnt evenly spaced elements of a sorted run,
+*                  an empty run still has to provide sample_cnt samples
+*/
+template<typename dtype>
+std::vector<dtype> regular_sample(const run_view<dtype>& sorted_run, const int& sample_cnt)
+{
+    std::vector<dtype> sample_list;
+    size_t item_cnt = sorted_run.size();
+    for (int i = 0; i < sample_cnt; ++i)
+    {
+        size_t idx = item_cnt * i / sample_cnt;
+        sample_list.emplace_back(item_cnt > 0 ? sorted_run.at(idx) : dtype());
+    }
+    return sample_list;
+}
+
+/*
+* pick_splitters - root gathers the same number of samples from every
+*                  rank, picks comm_size - 1 pivots at regular strides of
+*                  the sorted samples and broadcasts them
+*/
+template<typename dtype>
+std::vector<dtype> pick_splitters(
+    const std::vector<dtype>& sample_list,
+    const MPI_Datatype& mpi_type,
+    const int& root,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    int comm_size, comm_rank;
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_rank(comm, &comm_rank);
+
+    int sample_cnt = sample_list.size();
+    std::vector<dtype> all_sample;
+    if (comm_rank == root)
+        all_sample.resize((size_t)sample_cnt * comm_size);
+    MPI_Gather(
+        sample_list.data(), sample_cnt, mpi_type,
+        all_sample.data(), sample_cnt, mpi_type,
+        root, comm
+    );
+
+    std::vector<dtype> pivot_list(comm_size - 1);
+    if (comm_rank == root)
+    {
+        std::sort(all_sample.begin(), all_sample.end(), key_less<dtype>());
+        for (int i = 1; i < comm_size; ++i)
+            pivot_list[i - 1] = all_sample[all_sample.size() * i / comm_size];
+    }
+    MPI_Bcast(pivot_list.data(), pivot_list.size(), mpi_type, root, comm);
+    return pivot_list;
+}
+
+// value halfway between lo and hi without overflow, rounded towards lo
+template<typename dtype>
+dtype value_midpoint(const dtype& lo, const dtype& hi)
+{
+    if constexpr (std::is_integral<dtype>::value)
+    {
+        typedef typename std::make_unsigned<dtype>::type udtype;
+        return lo + (dtype)(((udtype)hi - (udtype)lo) / 2);
+    }
+    else
+        return lo / 2 + hi / 2;
+}
+
+struct split_stat
+{
+    int round_cnt = 0;                // refinement rounds performed
+    std::vector<uint64_t> part_list;  // global size of every partition
+    double imbalance = 1.0;           // largest partition over N / P
+};
+
+/*
+* refine_splitters - histogram refinement of the pivots, every round counts
+*                    globally how many elements fall below each pivot and
+*                    bisects the key range of pivots that are off target,
+*                    stops once the largest partition is at most
+*                    (1 + eps) * N / P or no pivot can move any more
+* eps - negative value only measures the imbalance of the given pivots
+*
+* records and indexed elements are bisected on their key, the midpoint is
+* written into the key of a copy of the pivot, pivots are only ever
+* compared by key so the rest of the copy does not matter
+*/
+template<typename dtype>
+split_stat refine_splitters(
+    const run_view<dtype>& sorted_run,
+    std::vector<dtype>& pivot_list,
+    const double& eps,
+    const int& max_round = 64,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    typedef typename sort_key<dtype>::key_type key_type;
+    static_assert(std::is_arithmetic<key_type>::value, "splitter refinement bisects an arithmetic key");
+    sort_key<dtype> key;
+    key_less<dtype> less;
+
+    int comm_size;
+    MPI_Comm_size(comm, &comm_size);
+    int pivot_cnt = comm_size - 1;
+    split_stat stat;
+
+    uint64_t local_cnt = sorted_run.size();
+    uint64_t global_cnt = 0;
+    MPI_Allreduce(&local_cnt, &global_cnt, 1, MPI_UINT64_T, MPI_SUM, comm);
+    double ideal = (double)global_cnt / comm_size;
+
+    // global number of elements not greater than each pivot
+    std::vector<uint64_t> below_list(pivot_cnt);
+    auto count_below = [&]() {
+        std::vector<uint64_t> local_below(pivot_cnt);
+        for (int j = 0; j < pivot_cnt; ++j)
+            local_below[j] = sorted_run.upper_bound(pivot_list[j]);
+        MPI_Allreduce(local_below.data(), below_list.data(), pivot_cnt, MPI_UINT64_T, MPI_SUM, comm);
+
+        stat.part_list.assign(comm_size, 0);
+        uint64_t largest = 0;
+        for (int i = 0; i < comm_size; ++i)
+        {
+            uint64_t head = i == 0 ? 0 : below_list[i - 1];
+            uint64_t tail = i == pivot_cnt ? global_cnt : below_list[i];
+            stat.part_list[i] = tail - head;
+            largest = std::max(largest, stat.part_list[i]);
+        }
+        stat.imbalance = ideal > 0 ? largest / ideal : 1.0;
+    };
+    count_below();
+    if (eps < 0 || pivot_cnt == 0)
+        return stat;
+
+    // bracket [lo, hi] of every pivot starts from the global key range
+    key_type local_min = local_cnt > 0 ? key(sorted_run.at(0)) : std::numeric_limits<key_type>::max();
+    key_type local_max = local_cnt > 0 ? key(sorted_run.at(local_cnt - 1)) : std::numeric_limits<key_type>::lowest();
+    key_type global_min, global_max;
+    MPI_Allreduce(&local_min, &global_min, 1, mpi_type<key_type>::get(), MPI_MIN, comm);
+    MPI_Allreduce(&local_max, &global_max, 1, mpi_type<key_type>::get(), MPI_MAX, comm);
+    std::vector<key_type> lo_list(pivot_cnt, global_min);
+    std::vector<key_type> hi_list(pivot_cnt, global_max);
+
+    // pivot j should have about N * (j + 1) / P elements below it, half of
+    // the slack on each side keeps every partition within the bound
+    double slack = eps * ideal / 2;
+    while (stat.imbalance > 1.0 + eps && stat.round_cnt < max_round)
+    {
+        bool moved = false;
+        std::vector<dtype> probe_list(pivot_list);
+        for (int j = 0; j < pivot_cnt; ++j)
+        {
+            double target = ideal * (j + 1);
+            // every pivot counted this round narrows every bracket
+            for (int k = 0; k < pivot_cnt; ++k)
+            {
+                const key_type& probe = key(probe_list[k]);
+                if (below_list[k] < target - slack && lo_list[j] < probe)
+                    lo_list[j] = probe;
+                if (below_list[k] > target + slack && probe < hi_list[j])
+                    hi_list[j] = probe;
+            }
+            if (below_list[j] >= target - slack && below_list[j] <= target + slack)
+                continue;
+
+            key_type mid = value_midpoint(lo_list[j], hi_list[j]);
+            if (mid < key(pivot_list[j]) || key(pivot_list[j]) < mid)
+            {
+                key(pivot_list[j]) = mid;
+                moved = true;
+            }
+        }
+        if (!moved) break;
+
+        std::sort(pivot_list.begin(), pivot_list.end(), less);
+        stat.round_cnt++;
+        count_below();
+    }
+    return stat;
+}
+
+/*
+* tie_split_bounds - local segment boundaries for every pivot, elements
+*                    below a pivot go to the lower segment and the run of
+*                    elements equal to it is cut at the global target
+*                    position, so a key repeated across many ranks is
+*                    spread over adjacent segments instead of one
+* return comm_size + 1 offsets, segment i is [bound[i], bound[i + 1])
+*/
+template<typename dtype>
+std::vector<size_t> tie_split_bounds(
+    const run_view<dtype>& sorted_run,
+    const std::vector<dtype>& pivot_list,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    int comm_size, comm_rank;
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_rank(comm, &comm_rank);
+    int pivot_cnt = comm_size - 1;
+
+    uint64_t local_cnt = sorted_run.size();
+    uint64_t global_cnt = 0;
+    MPI_Allreduce(&local_cnt, &global_cnt, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    // [less, less + equal) of the local run holds the keys equal to pivot j
+    std::vector<uint64_t> local_less(pivot_cnt), local_equal(pivot_cnt);
+    size_t first = 0;
+    for (int j = 0; j < pivot_cnt; ++j)
+    {
+        first = sorted_run.lower_bound(pivot_list[j], first);
+        local_less[j] = first;
+        local_equal[j] = sorted_run.upper_bound(pivot_list[j], first) - first;
+    }
+
+    std::vector<uint64_t> global_less(pivot_cnt), global_equal(pivot_cnt);
+    std::vector<uint64_t> equal_before(pivot_cnt, 0); // equal keys on lower ranks
+    MPI_Allreduce(local_less.data(), global_less.data(), pivot_cnt, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Allreduce(local_equal.data(), global_equal.data(), pivot_cnt, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Exscan(local_equal.data(), equal_before.data(), pivot_cnt, MPI_UINT64_T, MPI_SUM, comm);
+    if (comm_rank == 0)
+        std::fill(equal_before.begin(), equal_before.end(), 0); // exscan leaves rank 0 undefined
+
+    std::vector<size_t> bound(comm_size + 1);
+    bound[0] = 0;
+    bound[comm_size] = local_cnt;
+    for (int j = 0; j < pivot_cnt; ++j)
+    {
+        // equal keys that belong below the cut globally, then the part of
+        // them held by this rank, equal keys are ordered by rank
+        uint64_t target = global_cnt * (j + 1) / comm_size;
+        uint64_t cut = target <= global_less[j] ? 0 : std::min(target - global_less[j], global_equal[j]);
+        uint64_t mine = cut <= equal_before[j] ? 0 : std::min(cut - equal_before[j], local_equal[j]);
+        bound[j + 1] = local_less[j] + mine;
+    }
+    return bound;
+}
+
+/*
+* tie_split_at - local cut of a sorted run at a single pivot, elements
+*                below the pivot go below the cut and the run of elements
+*                equal to it is cut so that target elements of the whole
+*                comm end up below, equal keys are ordered by rank as in
+*                tie_split_bounds
+*/
+template<typename dtype>
+size_t tie_split_at(
+    const run_view<dtype>& sorted_run,
+    const dtype& pivot,
+    const uint64_t& target,
+    MPI_Comm comm = MPI_COMM_WORLD
+) {
+    int comm_rank;
+    MPI_Comm_rank(comm, &comm_rank);
+
+    uint64_t local_less = sorted_run.lower_bound(pivot);
+    uint64_t local_equal = sorted_run.upper_bound(pivot, local_less) - local_less;
+    uint64_t global_less = 0, global_equal = 0, equal_before = 0;
+    MPI_Allreduce(&local_less, &global_less, 1, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Allreduce(&local_equal, &global_equal, 1, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Exscan(&local_equal, &equal_before, 1, MPI_UINT64_T, MPI_SUM, comm);
+    if (comm_rank == 0)
+        equal_before = 0; // exscan leaves rank 0 undefined
+
+    uint64_t cut = target <= global_less ? 0 : std::min(target - global_less, global_equal);
+    uint64_t mine = cut <= equal_before ? 0 : std::min(cut - equal_before, local_equal);
+    return local_less + mine;
+}
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef STREAMMERGE_H
+#define STREAMMERGE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <myheap.h>
+#include <blockio.h>
+#include <sortkey.h>
+
+/*
+* spill_queue - fifo of the not yet merged part of one sorted stream,
+*               up to mem_cap elements stay in memory, anything beyond
+*               is appended to a spill file and read back in order
+*/
+template<typename dtype>
+class spill_queue
+{
+public:
+    spill_queue(const std::string& spill_path, const size_t& mem_cap)
+        : spill_path(spill_path), mem_cap(mem_cap), cursor(0),
+          fd(-1), spill_len(0), spill_pos(0), spilled_tlt(0), failed(false)
+    {
+    }
+
+    ~spill_queue()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            unlink(spill_path.c_str());
+        }
+    }
+
+    spill_queue(const spill_queue&) = delete;
+    spill_queue& operator=(const spill_queue&) = delete;
+
+    void push(const dtype* data, const size_t& cnt)
+    {
+        // once spilling starts every later chunk goes behind it on disk
+        if (spill_pos < spill_len || mem.size() - cursor + cnt > mem_cap)
+        {
+            spill(data, cnt);
+            return;
+        }
+        if (cursor > 0 && cursor >= mem.size() / 2)
+        {
+            mem.erase(mem.begin(), mem.begin() + cursor);
+            cursor = 0;
+        }
+        mem.insert(mem.end(), data, data + cnt);
+    }
+
+    // fetch the next element, return false if nothing is queued right now
+    bool next(dtype& value)
+    {
+        if (cursor == mem.size() && !reload())
+            return false;
+        value = mem[cursor++];
+        return true;
+    }
+
+    // total number of elements that ever went through the spill file
+    size_t spilled() const
+    {
+        return spilled_tlt;
+    }
+
+    bool good() const
+    {
+        return !failed;
+    }
+
+private:
+    void spill(const dtype* data, const size_t& cnt)
+    {
+        if (fd < 0)
+        {
+            fd = open(spill_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+            {
+                failed = true;
+                return;
+            }
+        }
+        const char* ptr = reinterpret_cast<const char*>(data);
+        size_t left = sizeof(dtype) * cnt;
+        off_t offset = sizeof(dtype) * spill_len;
+        while (left > 0)
+        {
+            ssize_t put_cnt = pwrite(fd, ptr, left, offset);
+            if (put_cnt <= 0)
+            {
+                failed = true;
+                return;
+            }
+            ptr += put_cnt;
+            left -= put_cnt;
+            offset += put_cnt;
+        }
+        spill_len += cnt;
+        spilled_tlt += cnt;
+    }
+
+    // memory is drained, bring the next part of the spill file back
+    bool reload()
+    {
+        mem.clear();
+        cursor = 0;
+        if (spill_pos == spill_len)
+            return false;
+
+        size_t cnt = std::min(mem_cap, spill_len - spill_pos);
+        mem.resize(cnt);
+        char* ptr = reinterpret_cast<char*>(mem.data());
+        size_t left = sizeof(dtype) * cnt;
+        off_t offset = sizeof(dtype) * spill_pos;
+        while (left > 0)
+        {
+            ssize_t got = pread(fd, ptr, left, offset);
+            if (got <= 0)
+            {
+                failed = true;
+                mem.clear();
+                return false;
+            }
+            ptr += got;
+            left -= got;
+            offset += got;
+        }
+        spill_pos += cnt;
+        // spill file fully read back, later chunks may stay in memory again
+        if (spill_pos == spill_len)
+            spill_pos = spill_len = 0;
+        return true;
+    }
+
+    std::string spill_path;
+    size_t mem_cap;
+    std::vector<dtype> mem;
+    size_t cursor;
+
+    int fd;
+    size_t spill_len; // elements written to the spill file
+    size_t spill_pos; // elements read back from the spill file
+    size_t spilled_tlt;
+    bool failed;
+};
+
+/*
+* stream_merger - k-way merge of sorted streams that arrive chunk by
+*                 chunk, output advances as long as every unfinished
+*                 stream has a queued head, a stream that runs ahead of
+*                 the merge frontier spills to disk
+* total_list - number of elements each stream will deliver in total
+* mem_cap - elements kept in memory per stream before spilling
+* writer - output constructed from (path, block size), see kmerge_pass
+*/
+template<typename dtype, typename writer = block_writer<dtype>>
+class stream_merger
+{
+    typedef std::pair<dtype, int> head_t;
+
+    // smallest key on top, a plain functor so the selector can inline it
+    struct cmp_t
+    {
+        bool operator()(const head_t& fp1, const head_t& fp2) const
+        {
+            return key_less<dtype>()(fp2.first, fp1.first);
+        }
+    };
+
+public:
+    stream_merger(
+        const std::string& output_path,
+        const std::string& spill_dir,
+        const std::vector<size_t>& total_list,
+        const size_t& mem_cap,
+        const size_t& block_size
+    ) : total_list(total_list), recv_list(total_list.size(), 0),
+        waiting(total_list.size(), 0), pending(0),
+        selector(cmp_t(), total_list.size()),
+        foutput(output_path, block_size)
+    {
+        for (size_t src = 0; src < total_list.size(); ++src)
+        {
+            queue_list.emplace_back(new spill_queue<dtype>(
+                spill_dir + "/" + std::to_string(src) + ".spill", mem_cap
+            ));
+            if (total_list[src] > 0)
+            {
+                waiting[src] = 1;
+                pending++;
+            }
+        }
+    }
+
+    bool is_open() const
+    {
+        return foutput.is_open();
+    }
+
+    // append the next chunk of stream src and merge as far as possible
+    void feed(const int& src, const dtype* data, const size_t& cnt)
+    {
+        if (cnt == 0) return;
+        queue_list[src]->push(data, cnt);
+        recv_list[src] += cnt;
+        if (waiting[src])
+        {
+            dtype head;
+            if (queue_list[src]->next(head))
+            {
+                selector.emplace(head, src);
+                waiting[src] = 0;
+                pending--;
+            }
+        }
+        advance();
+    }
+
+    // every stream has been fed completely, return false on io failure
+    bool finish()
+    {
+        advance();
+        foutput.close();
+        for (const auto& queue : queue_list)
+            if (!queue->good()) return false;
+        return pending == 0 && selector.empty();
+    }
+
+    size_t spilled() const
+    {
+        size_t spilled_tlt = 0;
+        for (const auto& queue : queue_list)
+            spilled_tlt += queue->spilled();
+        return spilled_tlt;
+    }
+
+private:
+    void advance()
+    {
+        while (pending == 0 && !selector.empty())
+        {
+            head_t& top = selector.top();
+            foutput.put(top.first);
+            int src = top.second;
+            if (queue_list[src]->next(top.first))
+                selector.sift_top();
+            else
+            {
+                selector.pop();
+                // stream not finished yet, its next value is unknown
+                if (recv_list[src] < total_list[src])
+                {
+                    waiting[src] = 1;
+                    pending++;
+                }
+            }
+        }
+    }
+
+    std::vector<size_t> total_list;
+    std::vector<size_t> recv_list;
+    std::vector<char> waiting; // stream owes a head to the selector
+    size_t pending;
+    std::vector<std::unique_ptr<spill_queue<dtype>>> queue_list;
+    heap<head_t, cmp_t> selector;
+    writer foutput;
+};
+
+#endif
@@ -22,3 +22,88 @@ void parse_args(
     }
 }
 
+
+dtype_id parse_dtype(const char* name)
+{
+    if (strcmp(name, "int32") == 0)  return DTYPE_INT32;
+    if (strcmp(name, "int64") == 0)  return DTYPE_INT64;
+    if (strcmp(name, "uint32") == 0) return DTYPE_UINT32;
+    if (strcmp(name, "uint64") == 0) return DTYPE_UINT64;
+    if (strcmp(name, "float") == 0)  return DTYPE_FLOAT;
+    if (strcmp(name, "double") == 0) return DTYPE_DOUBLE;
+    fprintf(stderr, "unknown data type %s, use one of %s\n", name, DTYPE_NAME_LIST);
+    exit(1);
+}
+
+size_t dtype_size(const dtype_id id)
+{
+    switch (id)
+    {
+    case DTYPE_INT32:  return sizeof(int32_t);
+    case DTYPE_INT64:  return sizeof(int64_t);
+    case DTYPE_UINT32: return sizeof(uint32_t);
+    case DTYPE_UINT64: return sizeof(uint64_t);
+    case DTYPE_FLOAT:  return sizeof(float);
+    case DTYPE_DOUBLE: return sizeof(double);
+    }
+    abort();
+}
+
+#define DTYPE_COMPARE(type, lhs, rhs) \
+    (*(const type*)(lhs) > *(const type*)(rhs)) - (*(const type*)(lhs) < *(const type*)(rhs))
+
+int dtype_compare(const dtype_id id, const void* lhs, const void* rhs)
+{
+    switch (id)
+    {
+    case DTYPE_INT32:  return DTYPE_COMPARE(int32_t, lhs, rhs);
+    case DTYPE_INT64:  return DTYPE_COMPARE(int64_t, lhs, rhs);
+    case DTYPE_UINT32: return DTYPE_COMPARE(uint32_t, lhs, rhs);
+    case DTYPE_UINT64: return DTYPE_COMPARE(uint64_t, lhs, rhs);
+    case DTYPE_FLOAT:  return DTYPE_COMPARE(float, lhs, rhs);
+    case DTYPE_DOUBLE: return DTYPE_COMPARE(double, lhs, rhs);
+    }
+    abort();
+}
+
+void dtype_print(const dtype_id id, const void* value)
+{
+    switch (id)
+    {
+    case DTYPE_INT32:  printf("%" PRId32 " ", *(const int32_t*)value); break;
+    case DTYPE_INT64:  printf("%" PRId64 " ", *(const int64_t*)value); break;
+    case DTYPE_UINT32: printf("%" PRIu32 " ", *(const uint32_t*)value); break;
+    case DTYPE_UINT64: printf("%" PRIu64 " ", *(const uint64_t*)value); break;
+    case DTYPE_FLOAT:  printf("%f ", *(const float*)value); break;
+    case DTYPE_DOUBLE: printf("%f ", *(const double*)value); break;
+    }
+}
+
+void dtype_store(const dtype_id id, const long long number, void* value)
+{
+    switch (id)
+    {
+    case DTYPE_INT32:  *(int32_t*)value = (int32_t)number; break;
+    case DTYPE_INT64:  *(int64_t*)value = (int64_t)number; break;
+    case DTYPE_UINT32: *(uint32_t*)value = (uint32_t)number; break;
+    case DTYPE_UINT64: *(uint64_t*)value = (uint64_t)number; break;
+    case DTYPE_FLOAT:  *(float*)value = (float)number; break;
+    case DTYPE_DOUBLE: *(double*)value = (double)number; break;
+    }
+}
+
+void dtype_store_bits(const dtype_id id, const uint64_t bits, void* value)
+{
+    // unsigned to signed through memcpy, the cast is implementation defined
+    uint32_t low = (uint32_t)bits;
+    double wide = (double)bits - 9223372036854775808.0; // centered on 0
+    switch (id)
+    {
+    case DTYPE_INT32:  memcpy(value, &low, sizeof(int32_t)); break;
+    case DTYPE_INT64:  memcpy(value, &bits, sizeof(int64_t)); break;
+    case DTYPE_UINT32: *(uint32_t*)value = low; break;
+    case DTYPE_UINT64: *(uint64_t*)value = bits; break;
+    case DTYPE_FLOAT:  *(float*)value = (float)wide; break;
+    case DTYPE_DOUBLE: *(double*)value = wide; break;
+    }
+}
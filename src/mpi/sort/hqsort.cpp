@@ -0,0 +1,345 @@
+#include <common_cpp.h>
+#include <mpi/mpi.h>
+#include <common_mpi.h>
+#include <splitter.h>
+
+namespace fs = std::filesystem;
+using std::endl;
+using std::cout;
+using std::cerr;
+using std::cin;
+
+// hypercube quicksort: after the local sort, round d splits every
+// subcube of 2^(d+1) nodes around the median of its local medians and each
+// node swaps the wrong half with its partner across dimension d, after
+// log2(P) rounds node i holds the i-th range of the global order
+
+
+// global data and option
+int buf_size = 0;
+const char* dtype_name = DTYPE_DEFAULT_NAME; // element type, see -t
+int sort_threads = 1;
+bool replace_select = false;
+char* bin_data_path = nullptr;
+char* result_path = nullptr; // globally sorted output, skipped when not given
+bool delete_temp = false;
+
+char processor_name[MPI_MAX_PROCESSOR_NAME];
+int processor_name_len;
+
+int world_size;
+int world_rank;
+int master_rank = 0;
+
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'f':
+        bin_data_path = optarg;
+        break;
+
+    case 't':
+        dtype_name = optarg;
+        break;
+
+    case 'o':
+        result_path = optarg;
+        break;
+
+    case 'D':
+        delete_temp = true;
+        break;
+
+    case 'b':
+        if ((buf_size = atoi(optarg)) <= 0)
+        {
+            // atoi can not tell if a conversion is failed
+            fprintf(stderr, "invalid buffer size %s\n", optarg);
+            exit(1);
+        }
+        break;
+
+    case 'R':
+        replace_select = true;
+        break;
+
+    case 'j':
+        if ((sort_threads = atoi(optarg)) <= 0)
+        {
+            fprintf(stderr, "invalid sort thread count %s\n", optarg);
+            exit(1);
+        }
+        break;
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+template<typename dtype>
+int internal_sort(
+    const char* input_name,
+    const char* output_name,
+    const int& buf_size
+);
+
+// median of the local medians of every non-empty node in cube_comm
+template<typename dtype>
+bool cube_pivot(const run_view<dtype>& sorted_run, MPI_Comm cube_comm, dtype& pivot);
+
+template<typename dtype>
+int sort_main(int argc, char** argv)
+{
+    mpi_init_funneled(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Get_processor_name(processor_name, &processor_name_len);
+
+    if (world_size & (world_size - 1))
+    {
+        if (world_rank == master_rank)
+            cerr << "hypercube quicksort needs a power of 2 processes, got " << world_size << endl;
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    timer timer_io("node" + std::to_string(world_rank) + " io", true); // input & output time
+    timer timer_ex("node" + std::to_string(world_rank) + " ex", true); // sort execution time
+    timer timer_st("node" + std::to_string(world_rank) + " st", true); // stage time
+
+    fs::path log_path = fs::path("log") / "node" / std::to_string(world_rank) / "run.log";
+    fs::create_directories(log_path.parent_path());
+    std::ofstream flogout(log_path, std::ofstream::trunc);
+    if (!flogout.is_open())
+    {
+        cerr << "node" << world_rank << " failed to open log file" << endl;
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    // step1: every node reads its own share of the input
+    timer_io.tick();
+    {
+        fs::path recv_path = fs::path("data/node") / std::to_string(world_rank) / "recv.bin";
+        parallel_read<dtype>(bin_data_path, recv_path, mpi_type<dtype>::get(), buf_size);
+    }
+    MPI_Barrier(MPI_COMM_WORLD); // end of data distribution
+    timer_io.tock("data distribution");
+
+    // step2: each proc sort its segment
+    timer_ex.tick();
+    int merge_pass = internal_sort<dtype>("recv.bin", "sorted.bin", buf_size);
+    MPI_Barrier(MPI_COMM_WORLD); // end of data each node file sort
+    timer_ex.tock("segment internal sort, " + std::to_string(merge_pass) + " merge pass(es)");
+
+    // step3: one round per hypercube dimension, highest dimension first
+    int dim_cnt = 0;
+    while ((1 << dim_cnt) < world_size) dim_cnt++;
+    {
+        fs::path base = fs::path("data/node") / std::to_string(world_rank);
+        fs::path self_path = base / "sorted.bin";
+        fs::path partner_path = base / "sorted_partner.bin";
+        fs::path merge_path = base / "merge.bin";
+        std::vector<dtype> tx_buf(buf_size);
+        std::vector<dtype> rx_buf(buf_size);
+
+        for (int dim = dim_cnt - 1; dim >= 0; --dim)
+        {
+            timer_st.tick();
+            int round = dim_cnt - 1 - dim;
+            int partner_rank = world_rank ^ (1 << dim);
+            bool keep_low = (world_rank & (1 << dim)) == 0;
+
+            // nodes that agree on every bit above dim form one subcube
+            MPI_Comm cube_comm;
+            MPI_Comm_split(MPI_COMM_WORLD, world_rank >> (dim + 1), world_rank, &cube_comm);
+
+            uint64_t keep_off, keep_cnt, tx_off;
+            uint64_t tx_ttl = 0;
+            uint64_t rx_ttl = 0;
+            timer_io.tick();
+            {
+                run_view<dtype> sorted_run(self_path);
+                if (!sorted_run.is_open())
+                {
+                    cerr << "node" << world_rank << " failed to open " << self_path << " during round" << round << endl;
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+
+                // values below the pivot belong to the lower half, values
+                // equal to it are cut by position so that the lower half
+                // gets about half of the subcube, a heavily repeated pivot
+                // would otherwise pull everything towards node 0
+                dtype pivot;
+                size_t split = 0;
+                if (cube_pivot(sorted_run, cube_comm, pivot))
+                {
+                    uint64_t local_cnt = sorted_run.size();
+                    uint64_t cube_cnt = 0;
+                    MPI_Allreduce(&local_cnt, &cube_cnt, 1, MPI_UINT64_T, MPI_SUM, cube_comm);
+                    split = tie_split_at(sorted_run, pivot, cube_cnt / 2, cube_comm);
+                }
+                keep_off = keep_low ? 0 : split;
+                keep_cnt = keep_low ? split : sorted_run.size() - split;
+                tx_off = keep_low ? split : 0;
+                tx_ttl = sorted_run.size() - keep_cnt;
+                MPI_Sendrecv(
+                    &tx_ttl, 1, MPI_UINT64_T, partner_rank, 0,
+                    &rx_ttl, 1, MPI_UINT64_T, partner_rank, 0,
+                    MPI_COMM_WORLD, MPI_STATUS_IGNORE
+                );
+
+                std::ofstream foutput(partner_path, std::ofstream::binary);
+                if (!foutput.is_open())
+                {
+                    cerr << "node" << world_rank << " failed to open " << partner_path << " during round" << round << endl;
+                    MPI_Abort(MPI_COMM_WORLD, 2);
+                }
+                // both sides know both totals, so they agree on the chunk count
+                for (uint64_t tx_done = 0, rx_done = 0; tx_done < tx_ttl || rx_done < rx_ttl; )
+                {
+                    int tx_cnt = std::min<uint64_t>(buf_size, tx_ttl - tx_done);
+                    int rx_cnt = std::min<uint64_t>(buf_size, rx_ttl - rx_done);
+                    sorted_run.read(tx_off + tx_done, tx_cnt, tx_buf.data());
+                    MPI_Sendrecv(
+                        tx_buf.data(), tx_cnt, mpi_type<dtype>::get(), partner_rank, 1,
+                        rx_buf.data(), rx_cnt, mpi_type<dtype>::get(), partner_rank, 1,
+                        MPI_COMM_WORLD, MPI_STATUS_IGNORE
+                    );
+                    foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * rx_cnt);
+                    tx_done += tx_cnt;
+                    rx_done += rx_cnt;
+                }
+                foutput.close();
+            }
+            MPI_Comm_free(&cube_comm);
+            timer_io.tock("hypercube round" + std::to_string(round) + " data exchange");
+
+            // keep own half, then merge the partner's half into it
+            timer_ex.tick();
+            c_truncate(self_path.c_str(), sizeof(dtype), keep_off, keep_cnt, buf_size);
+            std::vector<std::string> input_file_list {
+                self_path.c_str(),
+                partner_path.c_str()
+            };
+            kmerge_file<dtype>(input_file_list, merge_path.c_str(), buf_size);
+            fs::rename(merge_path, self_path);
+            timer_ex.tock("hypercube round" + std::to_string(round) + " merge partner segment");
+
+            timer_st.tock(
+                "hypercube round" + std::to_string(round) + " finish, sent "
+                + std::to_string(tx_ttl) + " received " + std::to_string(rx_ttl)
+            );
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // step4: each node writes its sorted segment into one shared result
+    if (result_path != nullptr)
+    {
+        timer_io.tick();
+        fs::path seg_sorted_path = fs::path("data/node") / std::to_string(world_rank) / "sorted.bin";
+        parallel_write<dtype>(seg_sorted_path, result_path, mpi_type<dtype>::get(), buf_size);
+        timer_io.tock("parallel write of sorted segments");
+    }
+
+    if (world_rank == master_rank)
+    {
+        // output time count statistic
+        auto io_duration_list = timer_io.get_duration_list();
+        auto io_caption_list = timer_io.get_caption_lits();
+        double io_total = timer_io.total_count();
+        flogout << "[io stages]" << endl;
+        for (size_t i = 0; i < io_duration_list.size(); ++i)
+        {
+            flogout << std::fixed << std::setprecision(2);
+            flogout << std::setw(10) << io_duration_list[i] / io_total * 100.0 << '%';
+            flogout.unsetf(std::ios::fixed);
+            flogout << std::setw(10) << io_duration_list[i] << 's';
+            flogout << " " << io_caption_list[i] << endl;
+        }
+
+        auto ex_duration_list = timer_ex.get_duration_list();
+        auto ex_caption_list = timer_ex.get_caption_lits();
+        double ex_total = timer_ex.total_count();
+        flogout << "[ex stages]" << endl;
+        for (size_t i = 0; i < ex_duration_list.size(); ++i)
+        {
+            flogout << std::fixed << std::setprecision(2);
+            flogout << std::setw(10) << ex_duration_list[i] / ex_total * 100.0 << '%';
+            flogout.unsetf(std::ios::fixed);
+            flogout << std::setw(10) << ex_duration_list[i] << 's';
+            flogout << " "<< ex_caption_list[i] << endl;
+        }
+    }
+
+
+    if (delete_temp && world_rank == master_rank)
+    {
+        clean_up({
+            "data/node",
+            "data/temp"
+        });
+    }
+
+    MPI_Finalize();
+    flogout.close();
+    return 0;
+}
+
+template<typename dtype>
+int internal_sort(
+    const char* input_name,
+    const char* output_name,
+    const int& buf_size
+) {
+    fs::path base_path = "data/node";
+
+    fs::path input_path = base_path / std::to_string(world_rank) / input_name;
+    fs::path output_path = base_path / std::to_string(world_rank) / output_name;
+
+    return sort_file<dtype>(input_path.c_str(), output_path.c_str(), buf_size, world_rank, sort_threads, replace_select);
+}
+
+template<typename dtype>
+bool cube_pivot(const run_view<dtype>& sorted_run, MPI_Comm cube_comm, dtype& pivot)
+{
+    int cube_size;
+    MPI_Comm_size(cube_comm, &cube_size);
+
+    int local_has = sorted_run.size() > 0;
+    dtype local_median = local_has ? sorted_run.at(sorted_run.size() / 2) : dtype();
+    std::vector<int> all_has(cube_size);
+    std::vector<dtype> all_median(cube_size);
+    MPI_Allgather(&local_has, 1, MPI_INT, all_has.data(), 1, MPI_INT, cube_comm);
+    MPI_Allgather(&local_median, 1, mpi_type<dtype>::get(), all_median.data(), 1, mpi_type<dtype>::get(), cube_comm);
+
+    std::vector<dtype> median_list;
+    for (int i = 0; i < cube_size; ++i)
+        if (all_has[i]) median_list.emplace_back(all_median[i]);
+    if (median_list.empty())
+        return false; // the whole subcube is empty, nothing to split
+
+    std::sort(median_list.begin(), median_list.end());
+    pivot = median_list[(median_list.size() - 1) / 2];
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "DRf:o:b:j:t:", &args_handler);
+
+    return dispatch_dtype(dtype_name, [&](auto tag) {
+        return sort_main<typename decltype(tag)::type>(argc, argv);
+    });
+}
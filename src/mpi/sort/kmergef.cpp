@@ -149,15 +149,18 @@ int main(int argc, char** argv)
     std::ofstream foutput("data/sorted.bin", std::ios::out | std::ios::binary);
     while (!ksegheap.empty())
     {
-        auto [finput, finput_head] = ksegheap.top();
-        ksegheap.pop();
+        // advance the top in place, no shared_ptr copy and a single sift-down
+        auto& [finput, finput_head] = ksegheap.top();
         foutput.write(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
 
         finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
         if (finput->gcount() == 0)
+        {
             finput->close();
+            ksegheap.pop();
+        }
         else
-            ksegheap.push(std::make_pair(finput, finput_head));
+            ksegheap.sift_top();
     }
     foutput.close();
 
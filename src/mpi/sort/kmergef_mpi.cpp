@@ -3,97 +3,45 @@
 #include <ctype.h>
 
 #include <mpi/mpi.h>
+#include <common_mpi.h>
 
 #include <functional>
 #include <memory>
 #include <myheap.h>
 
 #include <filesystem>
+#include <map>
 
 // global data and option
 int buf_sze = 0;
+const char* dtype_name = DTYPE_DEFAULT_NAME; // element type, see -t
+int sort_threads = 1;
+int fan_in = 2; // runs merged by every tree node per round
+bool replace_select = false;
 char* bin_data_path = nullptr;
 bool delete_temp = false;
 
 // global function
 void parse_args(int argc, char** argv);
 
-int main(int argc, char** argv)
+template<typename dtype>
+int sort_main(int argc, char** argv)
 {
-    parse_args(argc, argv);
-
     srand((unsigned int)time(NULL));
 
-    MPI_Init(&argc, &argv);
+    mpi_init_funneled(&argc, &argv);
 
     int world_size;
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
     int world_rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
 
-    // distribute data to all nodes
+    // every node reads its own share of the input
     {
-        std::ifstream finput;
-        if (world_rank == 0)
-        {
-            // master node is respnsible for reading in the data
-            finput.open(bin_data_path, std::ifstream::in | std::ifstream::binary);
-            if (!finput.is_open())
-            {
-                fprintf(stderr, "failed to open %s\n", bin_data_path);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-            }
-        }
-
         char file_path[128];
         sprintf(file_path, "data/mpi/node%d/recv.bin", world_rank);
-        std::filesystem::create_directories(std::filesystem::path(file_path).parent_path()); // return false if dir already exists
-        std::ofstream foutput(file_path, std::ofstream::out | std::ofstream::binary);
-        if (!foutput.is_open())
-        {
-            fprintf(stderr, "failed to open %s\n", file_path);
-            MPI_Abort(MPI_COMM_WORLD, 2);
-        }
-
-        std::vector<int> send_data(buf_sze);
-        std::vector<int> recv_data(buf_sze);
-        int rx_cnt;
-        int tx_cnt;
-        do {
-            if (world_rank == 0)
-            {
-                finput.read(reinterpret_cast<char*>(send_data.data()), sizeof(int) * buf_sze);
-                rx_cnt = finput.gcount() / sizeof(int);
-            }
-            // every node must know the amount to receive
-            MPI_Bcast(&rx_cnt, 1, MPI_INT, 0, MPI_COMM_WORLD);
-            if (rx_cnt == 0) break; // no data
-            tx_cnt = (rx_cnt - 1) / world_size + 1;
-            
-            MPI_Scatter(
-                send_data.data(),
-                tx_cnt,
-                MPI_INT,
-                recv_data.data(),
-                tx_cnt,
-                MPI_INT,
-                0,
-                MPI_COMM_WORLD
-            );
-
-            // each node dump the receive data to disk
-            foutput.write(reinterpret_cast<char*>(recv_data.data()), sizeof(int) * tx_cnt);
-        } while (rx_cnt == buf_sze);
-
-        if (world_rank == 0)
-            finput.close();
-        foutput.close();
+        parallel_read<dtype>(bin_data_path, file_path, mpi_type<dtype>::get(), buf_sze);
     }
-
-
-
-
-
     MPI_Barrier(MPI_COMM_WORLD); // end of data distribution
 
 
@@ -101,111 +49,13 @@ int main(int argc, char** argv)
 
 
     // each node sorts its segment
-    int seg_cnt = 0;
     {
-        int rx_cnt = 0;
-        std::vector<int> rx_buf(buf_sze);
         char file_path[128];
-
         sprintf(file_path, "data/mpi/node%d/recv.bin", world_rank);
-        std::ifstream finput(file_path, std::ifstream::in | std::ifstream::binary);
-        if (!finput.is_open())
-        {
-            // exit this process only
-            fprintf(stderr, "node%d failed to open segment %s, exit...\n", world_rank, file_path);
-            exit(1);
-        }
-        do {
-            finput.read(reinterpret_cast<char*>(rx_buf.data()), sizeof(int) * buf_sze);
-            rx_cnt = finput.gcount() / sizeof(int);
-            if (rx_cnt == 0) break;
-
-            std::sort(rx_buf.begin(), rx_buf.end());
-
-            sprintf(file_path, "data/mpi/node%d/%d.bin", world_rank, seg_cnt);
-            std::ofstream foutput(file_path, std::ofstream::out | std::ofstream::binary);
-            std::filesystem::create_directories(std::filesystem::path(file_path).parent_path());
-            if (!foutput.is_open())
-            {
-                fprintf(stderr, "node %d failed to dump sorted sub-segment %d", world_rank, seg_cnt);
-                continue;
-            }
-
-            foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(int) * rx_cnt);
-            foutput.close();
-
-            seg_cnt++;
-        } while (rx_cnt == buf_sze);
-    }
-
-
-
-
-
-    /*
-    ============================== division ==============================
-    ============================== division ==============================
-    ============================== division ==============================
-    ============================== division ==============================
-    ============================== division ==============================
-    */
-    // start k-way heap merge
-    {
-        std::function<
-            bool(
-                const std::pair<std::shared_ptr<std::ifstream>, int>&,
-                const std::pair<std::shared_ptr<std::ifstream>, int>&
-            )
-        > cmp = [](
-            const std::pair<std::shared_ptr<std::ifstream>, int>& fp1,
-            const std::pair<std::shared_ptr<std::ifstream>, int>& fp2
-        ) {
-            return fp1.second > fp2.second; // ascend heap, not descend heap
-        };
-        heap<std::pair<std::shared_ptr<std::ifstream>, int>, decltype(cmp)> ksegheap(cmp);
-
-        char file_path[128];
-        for (int i = 0; i < seg_cnt; ++i)
-        {
-            sprintf(file_path, "data/mpi/node%d/%d.bin", world_rank, i);
-            std::shared_ptr<std::ifstream> finput = std::make_shared<std::ifstream>(
-                file_path, std::ifstream::in | std::ifstream::binary
-            );
-            if (!finput->is_open()) {
-                fprintf(stderr, "failed to open %s\n", file_path);
-                continue;
-            }
-            int finput_head;
-            finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
-            if (finput->gcount() == 0)
-                continue;
-            // can't use std::pair<type1, type2> to construct
-            // there is no such constructor for std::pair
-            ksegheap.push(std::make_pair(finput, finput_head));
-        }
-
+        std::string input_file_path = std::string(file_path);
         sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
-        std::ofstream foutput(file_path, std::ios::out | std::ios::binary);
-        std::filesystem::create_directories(std::filesystem::path(file_path).parent_path());
-        if (!foutput.is_open())
-        {
-            fprintf(stderr, "node%d failed to open sorted segment\n", world_rank);
-            exit(4);
-        }
-
-        while (!ksegheap.empty())
-        {
-            auto [finput, finput_head] = ksegheap.top();
-            ksegheap.pop();
-            foutput.write(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
-
-            finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
-            if (finput->gcount() == 0)
-                finput->close();
-            else
-                ksegheap.push(std::make_pair(finput, finput_head));
-        }
-        foutput.close();
+        std::string output_file_path = std::string(file_path);
+        sort_file<dtype>(input_file_path, output_file_path, buf_sze, world_rank, sort_threads, replace_select);
     }
 
 
@@ -214,64 +64,88 @@ int main(int argc, char** argv)
 
 
 
-    if (world_rank == 0)
+    // k-ary tree merge, in the round with stride s every node whose rank is
+    // a multiple of s * k receives the runs of rank + j * s (0 < j < k) and
+    // merges them with its own, log_k(P) rounds leave the result on node 0
     {
-        // do the external k merge again
-        std::function<
-            bool(
-                const std::pair<std::shared_ptr<std::ifstream>, int>&,
-                const std::pair<std::shared_ptr<std::ifstream>, int>&
-            )
-        > cmp = [](
-            const std::pair<std::shared_ptr<std::ifstream>, int>& fp1,
-            const std::pair<std::shared_ptr<std::ifstream>, int>& fp2
-        ) {
-            return fp1.second > fp2.second; // ascend heap, not descend heap
-        };
-        heap<std::pair<std::shared_ptr<std::ifstream>, int>, decltype(cmp)> ksegheap(cmp);
-
-        char file_path[128];
-
-        for (int i = 0; i < world_size; ++i)
+        std::vector<dtype> recv_data(buf_sze);
+        int round = 0;
+        for (long stride = 1; stride < world_size; stride *= fan_in, ++round)
         {
-            sprintf(file_path, "data/mpi/node%d/sorted.bin", i);
-            std::shared_ptr<std::ifstream> finput = std::make_shared<std::ifstream>(
-                file_path, std::ifstream::in | std::ifstream::binary
-            );
-            if (!finput->is_open()) {
-                fprintf(stderr, "failed to open %s\n", file_path);
-                continue;
+            if (world_rank % (stride * fan_in) == 0)
+            {
+                // children send at the same time, every chunk is routed to
+                // the file of its source, a short chunk ends a child's run
+                std::vector<std::string> input_file_list;
+                std::map<int, std::ofstream> child_output;
+                char file_path[128];
+                sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
+                input_file_list.emplace_back(file_path);
+                for (int j = 1; j < fan_in && world_rank + j * stride < world_size; ++j)
+                {
+                    int child_rank = world_rank + j * stride;
+                    sprintf(file_path, "data/mpi/node%d/sorted_child%d.bin", world_rank, j);
+                    input_file_list.emplace_back(file_path);
+                    child_output[child_rank].open(file_path, std::ofstream::out | std::ofstream::binary);
+                    if (!child_output[child_rank].is_open())
+                    {
+                        fprintf(stderr, "node%d failed to receive child node%d's sorted data\n", world_rank, child_rank);
+                        MPI_Abort(MPI_COMM_WORLD, 5);
+                    }
+                }
+
+                size_t running = child_output.size();
+                while (running > 0)
+                {
+                    MPI_Status recv_status;
+                    int rx_cnt = 0;
+                    MPI_Recv(recv_data.data(), buf_sze, mpi_type<dtype>::get(), MPI_ANY_SOURCE, round, MPI_COMM_WORLD, &recv_status);
+                    MPI_Get_count(&recv_status, mpi_type<dtype>::get(), &rx_cnt);
+                    std::ofstream& foutput = child_output[recv_status.MPI_SOURCE];
+                    foutput.write(reinterpret_cast<char*>(recv_data.data()), sizeof(dtype) * rx_cnt);
+                    if (rx_cnt < buf_sze)
+                    {
+                        foutput.close();
+                        running--;
+                    }
+                }
+                if (input_file_list.size() == 1)
+                    continue; // no child left at this stride
+
+                sprintf(file_path, "data/mpi/node%d/merge.bin", world_rank);
+                std::string merge_file_path = std::string(file_path);
+                kmerge_file<dtype>(input_file_list, merge_file_path, buf_sze);
+                // prepare for next merge read
+                std::filesystem::rename(merge_file_path, input_file_list[0]);
+                for (size_t j = 1; j < input_file_list.size(); ++j)
+                    std::filesystem::remove(input_file_list[j]);
+            }
+            else if (world_rank % stride == 0)
+            {
+                // this node hands its run to the parent and is done
+                int parent_rank = world_rank - world_rank % (stride * fan_in);
+                char file_path[128];
+                sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
+                std::ifstream finput(file_path, std::ifstream::in | std::ifstream::binary);
+                if (!finput.is_open())
+                {
+                    fprintf(stderr, "node%d failed to open sorted data bin file\n", world_rank);
+                    MPI_Abort(MPI_COMM_WORLD, 5);
+                }
+
+                std::vector<dtype> send_data(buf_sze);
+                int tx_cnt = 0;
+                do {
+                    finput.read(reinterpret_cast<char*>(send_data.data()), sizeof(dtype) * buf_sze);
+                    tx_cnt = finput.gcount() / sizeof(dtype);
+                    MPI_Send(send_data.data(), tx_cnt, mpi_type<dtype>::get(), parent_rank, round, MPI_COMM_WORLD);
+                } while (tx_cnt == buf_sze);
+                finput.close();
             }
-            int finput_head;
-            finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
-            if (finput->gcount() == 0)
-                continue;
-            // can't use std::pair<type1, type2> to construct
-            // there is no such constructor for std::pair
-            ksegheap.push(std::make_pair(finput, finput_head));
-        }
-
-        std::ofstream foutput("data/mpi/sorted.bin", std::ios::out | std::ios::binary);
-        std::filesystem::create_directories(std::filesystem::path(file_path).parent_path());
-        if (!foutput.is_open())
-        {
-            fprintf(stderr, "node%d failed to open sorted segment\n", world_rank);
-            exit(4);
         }
 
-        while (!ksegheap.empty())
-        {
-            auto [finput, finput_head] = ksegheap.top();
-            ksegheap.pop();
-            foutput.write(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
-
-            finput->read(reinterpret_cast<char*>(&finput_head), 1 * sizeof(int));
-            if (finput->gcount() == 0)
-                finput->close();
-            else
-                ksegheap.push(std::make_pair(finput, finput_head));
-        }
-        foutput.close();
+        if (world_rank == 0)
+            std::filesystem::rename("data/mpi/node0/sorted.bin", "data/mpi/sorted.bin");
     }
 
 
@@ -304,13 +178,17 @@ void parse_args(int argc, char** argv)
     extern int   optind;
 
     int opt;
-    while ((opt = getopt(argc, argv, "Df:b:")) != -1)
+    while ((opt = getopt(argc, argv, "DRf:b:j:k:t:")) != -1)
     {
         switch (opt)
         {
         case 'f':
             bin_data_path = optarg;
             break;
+
+        case 't':
+            dtype_name = optarg;
+            break;
         
         case 'D':
             delete_temp = true;
@@ -324,6 +202,23 @@ void parse_args(int argc, char** argv)
                 exit(1);
             }
             break;
+        case 'R':
+            replace_select = true;
+            break;
+        case 'k':
+            if ((fan_in = atoi(optarg)) < 2)
+            {
+                fprintf(stderr, "invalid merge fan in %s, need at least 2\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j':
+            if ((sort_threads = atoi(optarg)) <= 0)
+            {
+                fprintf(stderr, "invalid sort thread count %s\n", optarg);
+                exit(1);
+            }
+            break;
         case '?':
             if (optopt == 'o')
                 fprintf(stderr, "Option -%c requires an argument.\n", optopt);
@@ -337,3 +232,12 @@ void parse_args(int argc, char** argv)
         }
     }
 }
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv);
+
+    return dispatch_dtype(dtype_name, [&](auto tag) {
+        return sort_main<typename decltype(tag)::type>(argc, argv);
+    });
+}
@@ -1,6 +1,8 @@
 #include <common_cpp.h>
 
 #include <mpi/mpi.h>
+#include <common_mpi.h>
+#include <mpistream.h>
 
 namespace fs = std::filesystem;
 using std::endl;
@@ -8,18 +10,11 @@ using std::cout;
 using std::cerr;
 using std::cin;
 
-#ifdef USE_INT
-    typedef int dtype;
-    #define MPI_DTYPE MPI_INT
-#endif
-
-#ifdef USE_FLT
-    typedef float dtype;
-    #define MPI_DTYPE MPI_FLOAT
-#endif
-
 // global data and option
 int buf_size = 0;
+const char* dtype_name = DTYPE_DEFAULT_NAME; // element type, see -t
+int sort_threads = 1;
+bool replace_select = false;
 char* bin_data_path = nullptr;
 bool delete_temp = false;
 
@@ -35,6 +30,10 @@ void args_handler(
     case 'f':
         bin_data_path = optarg;
         break;
+
+    case 't':
+        dtype_name = optarg;
+        break;
     
     case 'D':
         delete_temp = true;
@@ -48,6 +47,18 @@ void args_handler(
             exit(1);
         }
         break;
+
+    case 'R':
+        replace_select = true;
+        break;
+
+    case 'j':
+        if ((sort_threads = atoi(optarg)) <= 0)
+        {
+            fprintf(stderr, "invalid sort thread count %s\n", optarg);
+            exit(1);
+        }
+        break;
     case '?':
         if (optopt == 'o')
             fprintf(stderr, "Option -%c requires an argument.\n", optopt);
@@ -61,83 +72,23 @@ void args_handler(
     }
 }
 
-int main(int argc, char** argv)
+template<typename dtype>
+int sort_main(int argc, char** argv)
 {
-    parse_args(argc, argv, "Df:b:", &args_handler);
-
     srand((unsigned int)time(NULL));
 
-    MPI_Init(&argc, &argv);
+    mpi_init_funneled(&argc, &argv);
 
     int world_size;
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
     int world_rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
 
-    if (world_size % 2 != 0)
+    // every node reads its own share of the input
     {
-        cerr << "kmerge does not support non-even distribution" << endl;
-        MPI_Abort(MPI_COMM_WORLD, -1);
-    }
-
-
-    // distribute data to all nodes
-    {
-        std::ifstream finput;
-        if (world_rank == 0)
-        {
-            // master node is respnsible for reading in the data
-            finput.open(bin_data_path, std::ifstream::in | std::ifstream::binary);
-            if (!finput.is_open())
-            {
-                fprintf(stderr, "failed to open %s\n", bin_data_path);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-            }
-        }
-
         char file_path[128];
         sprintf(file_path, "data/mpi/node%d/recv.bin", world_rank);
-        std::filesystem::create_directories(std::filesystem::path(file_path).parent_path()); // return false if dir already exists
-        std::ofstream foutput(file_path, std::ofstream::out | std::ofstream::binary);
-        if (!foutput.is_open())
-        {
-            fprintf(stderr, "failed to open %s\n", file_path);
-            MPI_Abort(MPI_COMM_WORLD, 2);
-        }
-
-        std::vector<int> send_data(buf_size);
-        std::vector<int> recv_data(buf_size);
-        int rx_cnt = 0;
-        int tx_cnt = 0;
-        do {
-            if (world_rank == 0)
-            {
-                finput.read(reinterpret_cast<char*>(send_data.data()), sizeof(int) * buf_size);
-                rx_cnt = finput.gcount() / sizeof(int);
-            }
-            // every node must know the amount to receive
-            MPI_Bcast(&rx_cnt, 1, MPI_INT, 0, MPI_COMM_WORLD);
-            if (rx_cnt == 0) break; // no data
-            
-            tx_cnt = (rx_cnt - 1) / world_size + 1;
-            MPI_Scatter(
-                send_data.data(),
-                tx_cnt,
-                MPI_INT,
-                recv_data.data(),
-                tx_cnt,
-                MPI_INT,
-                0,
-                MPI_COMM_WORLD
-            );
-
-            // each node dump the receive data to disk
-            foutput.write(reinterpret_cast<char*>(recv_data.data()), sizeof(int) * tx_cnt);
-        } while (rx_cnt == buf_size);
-
-        if (world_rank == 0)
-            finput.close();
-        foutput.close();
+        parallel_read<dtype>(bin_data_path, file_path, mpi_type<dtype>::get(), buf_size);
     }
     MPI_Barrier(MPI_COMM_WORLD); // end of data distribution
 
@@ -149,94 +100,90 @@ int main(int argc, char** argv)
         std::string input_file_path = std::string(file_path);
         sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
         std::string output_file_path = std::string(file_path);
-        sort_file<dtype>(input_file_path, output_file_path, buf_size, world_rank);
+        sort_file<dtype>(input_file_path, output_file_path, buf_size, world_rank, sort_threads, replace_select);
     }
     MPI_Barrier(MPI_COMM_WORLD); // end of data each node file sort
 
 
-    // logn merge by multiple process nodes
+    // logn merge by multiple process nodes, streamed along a binomial tree:
+    // node r merges its own run with the streams of children r + 2^j
+    // (2^j below the lowest set bit of r) and streams the result to parent
+    // r - lowbit(r) while it is still being produced, so every level works
+    // at the same time and node 0 writes the final output
     {
-        std::vector<int> send_data(buf_size);
-        std::vector<int> recv_data(buf_size);
-        int rx_cnt = 0;
-        int tx_cnt = 0;
-
-        for (int i = 2; i <= world_size; i *= 2)
+        int dim_cnt = 0;
+        while ((1 << dim_cnt) < world_size) dim_cnt++;
+        // every node needs the same chunk size, so it only depends on -b and
+        // the widest node: two blocks per stream plus the local run
+        size_t chunk_size = kmerge_block_size(buf_size, 2 * dim_cnt + 3);
+
+        int lowbit = world_rank & -world_rank;
+        int parent_rank = world_rank == 0 ? -1 : world_rank - lowbit;
+        std::vector<std::unique_ptr<mpi_stream_reader<dtype>>> child_list;
+        for (int step = 1; step < world_size && (world_rank == 0 || step < lowbit); step *= 2)
         {
-            if (world_rank % i == 0)
-            {
-                // this node should receive from partner
-                // and do the merge
-                int partner_rank = world_rank + i / 2;
-                // printf("node%d will receive from node%d\n", world_rank, partner_rank);
-                char file_path[128];
-                sprintf(file_path, "data/mpi/node%d/sorted_partner.bin", world_rank);
-                std::filesystem::create_directories(std::filesystem::path(file_path).parent_path());
-                std::ofstream foutput(file_path, std::ofstream::out | std::ofstream::binary);
-                if (!foutput.is_open())
-                {
-                    fprintf(stderr, "node%d failed to receive partner node%d's sorted data\n", world_rank, partner_rank);
-                    MPI_Abort(MPI_COMM_WORLD, 5);
-                }
+            if (world_rank + step >= world_size) break;
+            child_list.emplace_back(new mpi_stream_reader<dtype>(world_rank + step, 0, mpi_type<dtype>::get(), chunk_size));
+        }
 
-                MPI_Status recv_status;
-                do {
-                    MPI_Recv(recv_data.data(), buf_size, MPI_INT, partner_rank, 0, MPI_COMM_WORLD, &recv_status);
-                    MPI_Get_count(&recv_status, MPI_INT, &rx_cnt);
+        char file_path[128];
+        sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
+        block_reader<dtype> local_run(file_path, chunk_size);
+        if (!local_run.is_open())
+        {
+            fprintf(stderr, "node%d failed to open sorted data bin file\n", world_rank);
+            MPI_Abort(MPI_COMM_WORLD, 5);
+        }
 
-                    foutput.write(reinterpret_cast<char*>(recv_data.data()), sizeof(int) * rx_cnt);
-                } while (rx_cnt == buf_size);
-                foutput.close();
+        // source 0 is the local run, source i is child i - 1
+        auto next_of = [&](const int& src, dtype& value) {
+            return src == 0 ? local_run.next(value) : child_list[src - 1]->next(value);
+        };
+        auto cmpt = [](
+            const std::pair<dtype, int>& fp1,
+            const std::pair<dtype, int>& fp2
+        ) {
+            return fp1.first > fp2.first; // ascend order, not descend order
+        };
+        std::vector<std::pair<dtype, int>> head_list;
+        for (int src = 0; src <= (int)child_list.size(); ++src)
+        {
+            dtype head;
+            if (next_of(src, head))
+                head_list.emplace_back(head, src);
+        }
+        heap<std::pair<dtype, int>, decltype(cmpt)> ksegtree(cmpt, std::move(head_list));
 
-                // merge into one sorted segment
-                std::vector<std::string> input_file_list;
-                sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
-                std::string input_file_path1 = std::string(file_path);
-                input_file_list.emplace_back(input_file_path1);
-                sprintf(file_path, "data/mpi/node%d/sorted_partner.bin", world_rank);
-                std::string input_file_path2 = std::string(file_path);
-                input_file_list.emplace_back(input_file_path2);
-                sprintf(file_path, "data/mpi/node%d/merge.bin", world_rank);
-                std::string merge_file_path = std::string(file_path);
-                kmerge_file<dtype>(input_file_list, merge_file_path);
-                // prepare for next merge read
-                std::filesystem::rename(merge_file_path, input_file_path1);
-            }
-            else if ((world_rank - i / 2) >= 0 && (world_rank - i / 2) % i == 0)
+        std::unique_ptr<block_writer<dtype>> foutput;
+        std::unique_ptr<mpi_stream_writer<dtype>> parent_stream;
+        if (parent_rank < 0)
+        {
+            std::filesystem::create_directories(std::filesystem::path("data/output/final.bin").parent_path());
+            foutput.reset(new block_writer<dtype>("data/output/final.bin", chunk_size));
+            if (!foutput->is_open())
             {
-                // this node should send to partner
-                int partner_rank = world_rank - i / 2;
-                // printf("node%d will send to node%d\n", world_rank, partner_rank);
-                char file_path[128];
-                sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
-                std::ifstream finput(file_path, std::ifstream::in | std::ifstream::binary);
-                if (!finput.is_open())
-                {
-                    fprintf(stderr, "node%d failed to open sorted data bin file\n", world_rank);
-                    MPI_Abort(MPI_COMM_WORLD, 5);
-                }
-
-                do {
-                    finput.read(reinterpret_cast<char*>(send_data.data()), sizeof(int) * buf_size);
-                    tx_cnt = finput.gcount() / sizeof(int);
-
-                    MPI_Send(send_data.data(), tx_cnt, MPI_INT, partner_rank, 0, MPI_COMM_WORLD);
-                } while (tx_cnt == buf_size);
-                finput.close();
+                fprintf(stderr, "node%d failed to open final output\n", world_rank);
+                MPI_Abort(MPI_COMM_WORLD, 6);
             }
         }
-    }
-    MPI_Barrier(MPI_COMM_WORLD);
+        else
+            parent_stream.reset(new mpi_stream_writer<dtype>(parent_rank, 0, mpi_type<dtype>::get(), chunk_size));
 
-    // put result to output folder
-    if (world_rank == 0)
-    {
-        char file_path[128];
-        sprintf(file_path, "data/mpi/node%d/sorted.bin", world_rank);
-        std::string result_path = std::string(file_path);
-        std::filesystem::create_directories(std::filesystem::path("data/output/final.bin").parent_path());
-        std::filesystem::rename(result_path, "data/output/final.bin");
+        while (!ksegtree.empty())
+        {
+            auto [head, src] = ksegtree.top();
+            if (foutput) foutput->put(head);
+            else         parent_stream->put(head);
+
+            if (next_of(src, head))
+                ksegtree.replace_top(std::make_pair(head, src));
+            else
+                ksegtree.pop();
+        }
+        if (foutput) foutput->close();
+        else         parent_stream->close();
     }
+    MPI_Barrier(MPI_COMM_WORLD);
 
     if (delete_temp)
     {
@@ -259,3 +206,12 @@ int main(int argc, char** argv)
     MPI_Finalize();
     return 0;
 }
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "DRf:b:j:t:", &args_handler);
+
+    return dispatch_dtype(dtype_name, [&](auto tag) {
+        return sort_main<typename decltype(tag)::type>(argc, argv);
+    });
+}
@@ -1,5 +1,6 @@
 #include <common_cpp.h>
 #include <mpi/mpi.h>
+#include <common_mpi.h>
 
 namespace fs = std::filesystem;
 using std::endl;
@@ -7,19 +8,14 @@ using std::cout;
 using std::cerr;
 using std::cin;
 
-#ifdef USE_INT
-    typedef int dtype;
-    #define MPI_DTYPE MPI_INT
-#endif
-
-#ifdef USE_FLT
-    typedef float dtype;
-    #define MPI_DTYPE MPI_FLOAT
-#endif
-
 
 // global data and option
 int buf_size = 0;
+const char* dtype_name = DTYPE_DEFAULT_NAME; // element type, see -t
+int sort_threads = 1;
+bool replace_select = false;
+bool central_scatter = false;
+bool full_exchange = false; // ship whole segments instead of merge-split
 char* bin_data_path = nullptr;
 bool delete_temp = false;
 
@@ -42,6 +38,10 @@ void args_handler(
     case 'f':
         bin_data_path = optarg;
         break;
+
+    case 't':
+        dtype_name = optarg;
+        break;
     
     case 'D':
         delete_temp = true;
@@ -55,6 +55,26 @@ void args_handler(
             exit(1);
         }
         break;
+
+    case 'C':
+        central_scatter = true; // master reads and scatters the whole input
+        break;
+
+    case 'F':
+        full_exchange = true;
+        break;
+
+    case 'R':
+        replace_select = true;
+        break;
+
+    case 'j':
+        if ((sort_threads = atoi(optarg)) <= 0)
+        {
+            fprintf(stderr, "invalid sort thread count %s\n", optarg);
+            exit(1);
+        }
+        break;
     
     case '?':
         if (isprint(optopt))
@@ -67,30 +87,48 @@ void args_handler(
     }
 }
 
+template<typename dtype>
 void scatter_data(
     const char* input_path,
     const char* output_name,
     const int& source_rank
 );
 
-void internal_sort(
+template<typename dtype>
+int internal_sort(
     const char* input_name,
     const char* output_name,
     const int& buf_size
 );
 
+// true on every node of comm once no segment holds a key greater than the
+// smallest key of the next non-empty segment
+template<typename dtype>
+bool segments_ordered(const fs::path& seg_path, MPI_Comm comm);
+
+// merge the partner's move_cnt keys into the region_cnt keys at the kept
+// end of self_path in place, lower node keeps the smallest keys
+template<typename dtype>
+void merge_split(
+    const char* self_path,
+    const char* partner_path,
+    const bool& keep_low,
+    const size_t& region_cnt,
+    const size_t& move_cnt
+);
+
+template<typename dtype>
 void gather_file(
     const char* common_path,
     const int& gather_rank
 );
 
-int main(int argc, char** argv)
+template<typename dtype>
+int sort_main(int argc, char** argv)
 {
-    parse_args(argc, argv, "Df:b:", &args_handler);
-
     srand((unsigned int)time(NULL));
 
-    MPI_Init(&argc, &argv);
+    mpi_init_funneled(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
     MPI_Get_processor_name(processor_name, &processor_name_len);
@@ -111,19 +149,34 @@ int main(int argc, char** argv)
 
     // step1: distribute data to all nodes
     timer_io.tick();
-    scatter_data(bin_data_path, "recv.bin", master_rank);
+    if (central_scatter)
+        scatter_data<dtype>(bin_data_path, "recv.bin", master_rank);
+    else
+    {
+        fs::path recv_path = fs::path("data/node") / std::to_string(world_rank) / "recv.bin";
+        parallel_read<dtype>(bin_data_path, recv_path, mpi_type<dtype>::get(), buf_size);
+    }
     MPI_Barrier(MPI_COMM_WORLD); // end of data distribution
     timer_io.tock("data distribution");
 
 
     // step2: each proc sort its segment
     timer_ex.tick();
-    internal_sort("recv.bin", "sorted.bin", buf_size);
+    int merge_pass = internal_sort<dtype>("recv.bin", "sorted.bin", buf_size);
     MPI_Barrier(MPI_COMM_WORLD); // end of data each node file sort
-    timer_ex.tock("segment internal sort");
+    timer_ex.tock("segment internal sort, " + std::to_string(merge_pass) + " merge pass(es)");
 
     // step3: segment prepare finish, now start odd even sort algorithm
+    // keys can not pass through an empty segment, so only the nodes that
+    // hold data take part in the phases
+    fs::path seg_sorted_path = fs::path("data/node") / std::to_string(world_rank) / "sorted.bin";
+    MPI_Comm sort_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, fs::file_size(seg_sorted_path) > 0 ? 0 : MPI_UNDEFINED, world_rank, &sort_comm);
+    if (sort_comm != MPI_COMM_NULL)
     {
+        int sort_size, sort_rank;
+        MPI_Comm_size(sort_comm, &sort_size);
+        MPI_Comm_rank(sort_comm, &sort_rank);
         int partner_rank;
 
         int rx_cnt = 0;
@@ -131,36 +184,126 @@ int main(int argc, char** argv)
         std::vector<dtype> rx_buf(buf_size);
         std::vector<dtype> tx_buf(buf_size);
 
-        for (int phase = 0; phase < world_size; ++phase)
+        // stop as soon as every segment boundary is in order, nearly sorted
+        // input needs far fewer than sort_size phases
+        int phase = 0;
+        bool ordered = false; // set only by a check, not by running out of phases
+        for (; phase < sort_size && !(ordered = segments_ordered<dtype>(seg_sorted_path, sort_comm)); ++phase)
         {
             timer_st.tick();
 
-            if (world_rank % 2 == 0)
+            if (sort_rank % 2 == 0)
             {
-                if (phase % 2 == 0) partner_rank = world_rank + 1;
-                else                partner_rank = world_rank - 1;
+                if (phase % 2 == 0) partner_rank = sort_rank + 1;
+                else                partner_rank = sort_rank - 1;
             }
             else
             {
-                if (phase % 2 == 0) partner_rank = world_rank - 1;
-                else                partner_rank = world_rank + 1;
+                if (phase % 2 == 0) partner_rank = sort_rank - 1;
+                else                partner_rank = sort_rank + 1;
             }
-            if (partner_rank < 0 || partner_rank == world_size) continue; // idle pass, no partner
+            if (partner_rank < 0 || partner_rank == sort_size) continue; // idle pass, no partner
             // printf("[phase %d node%d] %d<->%d\n", phase, world_rank, world_rank, partner_rank);
 
             fs::path base = "data/node";
-            // preparation for MPI_Sendrecv
-            // input file
             fs::path input_self_path = base / std::to_string(world_rank) / "sorted.bin";
+            fs::path output_partner_path = base / std::to_string(world_rank) / "sorted_partner.bin";
+            bool keep_low = sort_rank < partner_rank;
+
+            if (!full_exchange)
+            {
+                // merge-split: both nodes keep their sizes, only the part of
+                // each run that overlaps the partner's value range moves
+                uint64_t region_cnt = 0; // local elements that may change
+                uint64_t move_cnt = 0;   // elements sent to and received from partner
+                timer_io.tick();
+                {
+                    run_view<dtype> sorted_run(input_self_path);
+                    if (!sorted_run.is_open())
+                    {
+                        cerr << "node" << world_rank << " failed to open " << input_self_path << " during phase" << phase << endl;
+                        MPI_Abort(MPI_COMM_WORLD, 1);
+                    }
+                    size_t item_cnt = sorted_run.size();
+
+                    // lower node offers its largest key, upper node its smallest
+                    int self_has = item_cnt > 0;
+                    int partner_has = 0;
+                    dtype self_edge = self_has ? sorted_run.at(keep_low ? item_cnt - 1 : 0) : dtype();
+                    dtype partner_edge;
+                    MPI_Sendrecv(
+                        &self_has, 1, MPI_INT, partner_rank, 0,
+                        &partner_has, 1, MPI_INT, partner_rank, 0,
+                        sort_comm, MPI_STATUS_IGNORE
+                    );
+                    MPI_Sendrecv(
+                        &self_edge, 1, mpi_type<dtype>::get(), partner_rank, 0,
+                        &partner_edge, 1, mpi_type<dtype>::get(), partner_rank, 0,
+                        sort_comm, MPI_STATUS_IGNORE
+                    );
+
+                    // lower keeps every key not above the partner's minimum,
+                    // upper keeps every key not below the partner's maximum
+                    if (self_has && partner_has)
+                        region_cnt = keep_low
+                            ? item_cnt - sorted_run.upper_bound(partner_edge)
+                            : sorted_run.lower_bound(partner_edge);
+                    uint64_t partner_region = 0;
+                    MPI_Sendrecv(
+                        &region_cnt, 1, MPI_UINT64_T, partner_rank, 0,
+                        &partner_region, 1, MPI_UINT64_T, partner_rank, 0,
+                        sort_comm, MPI_STATUS_IGNORE
+                    );
+
+                    // the region takes at most region_cnt keys from the
+                    // partner, its nearest move_cnt keys are enough
+                    move_cnt = std::min(region_cnt, partner_region);
+                    size_t tx_off = keep_low ? item_cnt - move_cnt : 0;
+                    if (move_cnt > 0)
+                    {
+                        std::ofstream foutput(output_partner_path, std::ofstream::binary);
+                        if (!foutput.is_open())
+                        {
+                            cerr << "node" << world_rank << " failed to open " << output_partner_path << " during phase" << phase << endl;
+                            MPI_Abort(MPI_COMM_WORLD, 2);
+                        }
+                        for (uint64_t done = 0; done < move_cnt; done += tx_cnt)
+                        {
+                            tx_cnt = std::min<uint64_t>(buf_size, move_cnt - done);
+                            sorted_run.read(tx_off + done, tx_cnt, tx_buf.data());
+                            MPI_Sendrecv(
+                                tx_buf.data(), tx_cnt, mpi_type<dtype>::get(), partner_rank, 1,
+                                rx_buf.data(), tx_cnt, mpi_type<dtype>::get(), partner_rank, 1,
+                                sort_comm, MPI_STATUS_IGNORE
+                            );
+                            foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * tx_cnt);
+                        }
+                        foutput.close();
+                    }
+                }
+                timer_io.tock("oddeven phase" + std::to_string(phase) + " data exchange");
+
+                if (move_cnt > 0)
+                {
+                    timer_ex.tick();
+                    merge_split<dtype>(input_self_path.c_str(), output_partner_path.c_str(), keep_low, region_cnt, move_cnt);
+                    timer_ex.tock("oddeven phase" + std::to_string(phase) + " merge split");
+                }
+
+                timer_st.tock(
+                    "oddeven phase" + std::to_string(phase) + " finish, "
+                    + (move_cnt > 0 ? "exchanged " + std::to_string(move_cnt) : std::string("ranges apart"))
+                );
+                continue;
+            }
+
+            // full exchange: ship the whole segment, merge, keep one half
             std::ifstream finput(input_self_path, std::ifstream::binary);
             if (!finput.is_open())
             {
                 cerr << "node" << world_rank << " failed to open" << input_self_path << " during phase" << phase << endl;
                 MPI_Abort(MPI_COMM_WORLD, 1);
             }
-            // output file
-            fs::path output_partner_path = base / std::to_string(world_rank) / "sorted_partner.bin";
-            fs::create_directories(output_partner_path.parent_path());
             std::ofstream foutput(output_partner_path, std::ofstream::binary);
             if (!foutput.is_open())
             {
@@ -184,11 +327,11 @@ int main(int argc, char** argv)
                     if (tx_cnt == 0) finput.close();
                 }
                 MPI_Sendrecv(
-                    tx_buf.data(), tx_cnt,   MPI_DTYPE, partner_rank, 0, // send to partner
-                    rx_buf.data(), buf_size, MPI_DTYPE, partner_rank, 0, // receive from partner
-                    MPI_COMM_WORLD, &status
+                    tx_buf.data(), tx_cnt,   mpi_type<dtype>::get(), partner_rank, 0, // send to partner
+                    rx_buf.data(), buf_size, mpi_type<dtype>::get(), partner_rank, 0, // receive from partner
+                    sort_comm, &status
                 );
-                MPI_Get_count(&status, MPI_UNSIGNED_LONG, &rx_cnt);
+                MPI_Get_count(&status, mpi_type<dtype>::get(), &rx_cnt);
                 rx_ttl += rx_cnt;
                 foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * rx_cnt);
             } while (tx_cnt == buf_size || rx_cnt == buf_size);
@@ -202,7 +345,7 @@ int main(int argc, char** argv)
                 output_partner_path.c_str()
             };
             fs::path merge_path = base / std::to_string(world_rank) / "merge.bin";
-            kmerge_file<dtype>(input_file_list, merge_path.c_str());
+            kmerge_file<dtype>(input_file_list, merge_path.c_str(), buf_size);
             std::filesystem::rename(merge_path, input_self_path); // replace the original "sorted.bin"
             timer_ex.tock("oddeven phase" + std::to_string(phase) + " merge partner segment");
 
@@ -210,7 +353,7 @@ int main(int argc, char** argv)
             {
                 // tx_ttl represents node's segment size
                 // rx_ttl represents partner's segment size
-                if (world_rank < partner_rank)
+                if (keep_low)
                 {
                     // keep the smaller part
                     c_truncate(input_self_path.c_str(), sizeof(dtype), 0     , tx_ttl, buf_size);
@@ -224,6 +367,11 @@ int main(int argc, char** argv)
 
             timer_st.tock("oddeven phase" + std::to_string(phase) + " finish");
         }
+        if (ordered)
+            flogout << "[oddeven] in order after " << phase << " phase(s)" << endl;
+        else
+            flogout << "[oddeven] ran all " << sort_size << " phases" << endl;
+        MPI_Comm_free(&sort_comm);
     }
     MPI_Barrier(MPI_COMM_WORLD);
 
@@ -308,6 +456,7 @@ int main(int argc, char** argv)
     return 0;
 }
 
+template<typename dtype>
 void scatter_data(
     const char* input_path,
     const char* output_name,
@@ -348,21 +497,21 @@ void scatter_data(
             rx_cnt = finput.gcount() / sizeof(dtype);
         }
         // every node receive signal from main node
-        MPI_Bcast(&rx_cnt, 1, MPI_DTYPE, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&rx_cnt, 1, MPI_INT, 0, MPI_COMM_WORLD);
         if (rx_cnt == 0) break; // every node exit distribution stage
 
         tx_cnt = (rx_cnt - 1) / world_size + 1; // divided by each process node, (a-1)/b+1 is ceiling formula
         MPI_Scatter(
-            tx_buf.data(), tx_cnt, MPI_DTYPE,
-            rx_buf.data(), tx_cnt, MPI_DTYPE,
+            tx_buf.data(), tx_cnt, mpi_type<dtype>::get(),
+            rx_buf.data(), tx_cnt, mpi_type<dtype>::get(),
             source_rank, MPI_COMM_WORLD
         );
 
-        // last node may receive incomplete data
-        if (world_rank == world_size - 1)
-            tx_cnt = rx_cnt - tx_cnt * (world_size - 1);
+        // the tail of a short round may leave the last nodes with fewer
+        // elements or none at all
+        int own_cnt = std::max(0, std::min(tx_cnt, rx_cnt - tx_cnt * world_rank));
         // each node dump the receive data to disk
-        foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * tx_cnt);
+        foutput.write(reinterpret_cast<char*>(rx_buf.data()), sizeof(dtype) * own_cnt);
     } while (rx_cnt == buf_size);
 
     if (world_rank == 0)
@@ -370,7 +519,8 @@ void scatter_data(
     foutput.close();
 }
 
-void internal_sort(
+template<typename dtype>
+int internal_sort(
     const char* input_name,
     const char* output_name,
     const int& buf_size
@@ -381,9 +531,86 @@ void internal_sort(
     fs::path input_path = base_path / node_path / input_name;
     fs::path output_path = base_path / node_path / output_name;
 
-    sort_file<dtype>(input_path.c_str(), output_path.c_str(), buf_size, world_rank);
+    return sort_file<dtype>(input_path.c_str(), output_path.c_str(), buf_size, world_rank, sort_threads, replace_select);
 }
 
+template<typename dtype>
+bool segments_ordered(const fs::path& seg_path, MPI_Comm comm)
+{
+    int comm_size, comm_rank;
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_rank(comm, &comm_rank);
+
+    // every segment of comm is non-empty, so min and max always exist
+    run_view<dtype> sorted_run(seg_path);
+    dtype self_min = sorted_run.at(0);
+    dtype self_max = sorted_run.at(sorted_run.size() - 1);
+    dtype left_max = self_min;
+    int left_rank = comm_rank > 0 ? comm_rank - 1 : MPI_PROC_NULL;
+    int right_rank = comm_rank + 1 < comm_size ? comm_rank + 1 : MPI_PROC_NULL;
+    MPI_Sendrecv(
+        &self_max, 1, mpi_type<dtype>::get(), right_rank, 2,
+        &left_max, 1, mpi_type<dtype>::get(), left_rank, 2,
+        comm, MPI_STATUS_IGNORE
+    );
+
+    int local_ordered = !(self_min < left_max);
+    int global_ordered = 0;
+    MPI_Allreduce(&local_ordered, &global_ordered, 1, MPI_INT, MPI_LAND, comm);
+    return global_ordered;
+}
+
+template<typename dtype>
+void merge_split(
+    const char* self_path,
+    const char* partner_path,
+    const bool& keep_low,
+    const size_t& region_cnt,
+    const size_t& move_cnt
+) {
+    int self_fd = open(self_path, O_RDWR);
+    int partner_fd = open(partner_path, O_RDONLY);
+    if (self_fd < 0 || partner_fd < 0)
+    {
+        cerr << "node" << world_rank << " failed to open " << self_path << " for merge split" << endl;
+        MPI_Abort(MPI_COMM_WORLD, 3);
+    }
+    size_t item_cnt = fs::file_size(self_path) / sizeof(dtype);
+    size_t region_off = keep_low ? item_cnt - region_cnt : 0;
+
+    // the lower node walks both runs from the top and drops the move_cnt
+    // largest keys, the upper node walks from the bottom and drops the
+    // smallest, the write cursor never passes the unread part of the region
+    {
+        span_reader<dtype> self_reader(self_fd, region_off, region_cnt, keep_low, buf_size);
+        span_reader<dtype> partner_reader(partner_fd, 0, move_cnt, keep_low, buf_size);
+        span_writer<dtype> region_writer(self_fd, region_off, region_cnt, keep_low, buf_size);
+
+        dtype self_head, partner_head;
+        bool self_left = self_reader.next(self_head);
+        bool partner_left = partner_reader.next(partner_head);
+        for (size_t out = 0; out < region_cnt + move_cnt; ++out)
+        {
+            // take the key farther from the kept end first
+            bool take_self = !partner_left
+                || (self_left && (keep_low ? partner_head < self_head : self_head < partner_head));
+            dtype value = take_self ? self_head : partner_head;
+            if (take_self) self_left = self_reader.next(self_head);
+            else           partner_left = partner_reader.next(partner_head);
+            if (out >= move_cnt)
+                region_writer.put(value);
+        }
+        if (!region_writer.flush())
+        {
+            cerr << "node" << world_rank << " failed to write " << self_path << " during merge split" << endl;
+            MPI_Abort(MPI_COMM_WORLD, 3);
+        }
+    }
+    close(self_fd);
+    close(partner_fd);
+}
+
+template<typename dtype>
 void gather_file(
     const char* base,
     const char* file_path,
@@ -444,3 +671,12 @@ void gather_file(
         MPI_Barrier(MPI_COMM_WORLD);
     }
 }
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "CDFRf:b:j:t:", &args_handler);
+
+    return dispatch_dtype(dtype_name, [&](auto tag) {
+        return sort_main<typename decltype(tag)::type>(argc, argv);
+    });
+}
@@ -2,17 +2,8 @@
 
 #include <string.h>
 
-#ifdef USE_INT
-    typedef int dtype;
-    const char* dtype_printfstr = "%d ";
-#endif
-
-#ifdef USE_FLT
-    typedef float dtype;
-    const char* dtype_printfstr = "%f ";
-#endif
-
 char* file_path;
+dtype_id dtype = DTYPE_DEFAULT;
 bool use_asc = false;
 bool use_dsc = false;
 bool print_out = false;
@@ -41,6 +32,10 @@ void args_handler(
         file_path = optarg;
         break;
 
+    case 't':
+        dtype = parse_dtype(optarg);
+        break;
+
     case '?':
         if (isprint(optopt))
             fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -54,7 +49,7 @@ void args_handler(
 
 int main(int argc, char** argv)
 {
-    parse_args(argc, argv, "ADPFIf:", &args_handler);
+    parse_args(argc, argv, "ADPFIf:t:", &args_handler);
     if ((use_asc && use_dsc) || (!use_asc && !use_dsc))
     {
         printf("must select only 1 validate mode\n");
@@ -74,29 +69,32 @@ int main(int argc, char** argv)
     }
 
 
-    dtype prev;
-    dtype curr;
+    // 8 bytes hold any element type
+    uint64_t prev;
+    uint64_t curr;
+    size_t item_size = dtype_size(dtype);
 
-    if (fread(&prev, sizeof(dtype), 1, fp) < 1)
+    if (fread(&prev, item_size, 1, fp) < 1)
     {
         printf("empty data bin file\n");
         exit(1);
     }
 
-    int cnt = 1;
+    unsigned long long cnt = 1;
     bool isordered = true;
 
     if (print_out)
-        printf(dtype_printfstr, prev);
-    while (fread(&curr, sizeof(dtype), 1, fp) == 1)
+        dtype_print(dtype, &prev);
+    while (fread(&curr, item_size, 1, fp) == 1)
     {
         if (print_out)
-            printf(dtype_printfstr, curr);
+            dtype_print(dtype, &curr);
         cnt++;
-        if ((use_asc && prev > curr) || (use_dsc && prev < curr))
+        int order = dtype_compare(dtype, &prev, &curr);
+        if ((use_asc && order > 0) || (use_dsc && order < 0))
         {
-            printf("sequential order check failed at %d with ", cnt);
-            printf(dtype_printfstr, curr);
+            printf("sequential order check failed at %llu with ", cnt);
+            dtype_print(dtype, &curr);
             printf("\n");
             isordered = false;
         }
@@ -105,9 +103,9 @@ int main(int argc, char** argv)
     }
 
     if (isordered)
-        printf("\nsequential check passed with %d count\n", cnt);
+        printf("\nsequential check passed with %llu count\n", cnt);
     else
-        printf("\nsequential check failed with %d count\n", cnt);
+        printf("\nsequential check failed with %llu count\n", cnt);
     
     fclose(fp);
     return 0;
@@ -0,0 +1,96 @@
+#include <common_c.h>
+
+// duplicate heavy data: every element is one of key_cnt distinct keys and
+// hot_pct percent of them are the single key 0, used to stress partitioning
+
+char* file_path = NULL;
+dtype_id dtype = DTYPE_DEFAULT;
+unsigned long num = 0;
+int key_cnt = 1;
+int hot_pct = 0;
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'f':
+        file_path = optarg;
+        break;
+
+    case 'n':
+        num = atol(optarg);
+        break;
+
+    case 't':
+        dtype = parse_dtype(optarg);
+        break;
+
+    case 'k':
+        if ((key_cnt = atoi(optarg)) <= 0)
+        {
+            fprintf(stderr, "invalid key count %s\n", optarg);
+            exit(1);
+        }
+        break;
+
+    case 'p':
+        hot_pct = atoi(optarg);
+        if (hot_pct < 0 || hot_pct > 100)
+        {
+            fprintf(stderr, "invalid hot key percentage %s\n", optarg);
+            exit(1);
+        }
+        break;
+
+    case 'h':
+        printf("dupdata -f <path> -n <num> [-k <distinct keys>] [-p <hot key percentage>] [-t <%s>]\n", DTYPE_NAME_LIST);
+        exit(0);
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "hf:n:k:p:t:", &args_handler);
+    if (file_path == NULL)
+    {
+        fprintf(stderr, "no output file, use -f <path>\n");
+        exit(1);
+    }
+
+    srand((unsigned int)time(NULL));
+
+    FILE* fp = fopen(file_path, "wb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "failed to open file %s\n", file_path);
+        exit(1);
+    }
+
+    uint64_t data; // 8 bytes hold any element type
+    size_t item_size = dtype_size(dtype);
+    for (unsigned long i = 0; i < num; ++i)
+    {
+        dtype_store(dtype, (rand() % 100 < hot_pct) ? 0 : rand() % key_cnt, &data);
+        if (fwrite(&data, item_size, 1, fp) < 1)
+        {
+            fprintf(stderr, "failed to write data, abort\n");
+            exit(1);
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
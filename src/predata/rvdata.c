@@ -1,14 +1,7 @@
 #include <common_c.h>
 
-#ifdef USE_INT
-    typedef int dtype;
-#endif
-
-#ifdef USE_FLT
-    typedef float dtype;
-#endif
-
 char* input_path;
+dtype_id dtype = DTYPE_DEFAULT;
 char* output_path;
 bool print_out;
 
@@ -27,6 +20,10 @@ void args_handler(
     case 'o':
         output_path = optarg;
         break;
+
+    case 't':
+        dtype = parse_dtype(optarg);
+        break;
     
     case '?':
         if (optopt == 'o')
@@ -43,7 +40,7 @@ void args_handler(
 
 int main(int argc, char** argv)
 {
-    parse_args(argc, argv, "f:o:", &args_handler);
+    parse_args(argc, argv, "f:o:t:", &args_handler);
 
     FILE* finp = fopen(input_path, "rb");
     if (finp == NULL)
@@ -59,11 +56,12 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    dtype data;
+    uint64_t data; // 8 bytes hold any element type
+    size_t item_size = dtype_size(dtype);
 
     long cnt_dd = 0;
     fseek(finp, 0, SEEK_END);
-    cnt_dd = ftell(finp) / sizeof(dtype);
+    cnt_dd = ftell(finp) / item_size;
 
     printf("will reverse %ld data\n", cnt_dd);
 
@@ -71,9 +69,9 @@ int main(int argc, char** argv)
     long cnt_rx = 0;
     long cnt_tx = 0;
     do {
-        fseek(finp, -sizeof(dtype) * cnt_tl, SEEK_END);
-        cnt_rx = fread(&data, sizeof(dtype), 1, finp);
-        cnt_tx = fwrite(&data, sizeof(dtype), 1, foup);
+        fseek(finp, -item_size * cnt_tl, SEEK_END);
+        cnt_rx = fread(&data, item_size, 1, finp);
+        cnt_tx = fwrite(&data, item_size, 1, foup);
         if (cnt_rx == 0 || cnt_tx == 0)
         {
             printf("error rx/tx, exit...\n");
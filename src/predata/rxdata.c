@@ -1,14 +1,7 @@
 #include <common_c.h>
 
-#ifdef USE_INT
-    typedef int dtype;
-#endif
-
-#ifdef USE_FLT
-    typedef float dtype;
-#endif
-
 char* file_path;
+dtype_id dtype = DTYPE_DEFAULT;
 bool print_out;
 
 void args_handler(
@@ -26,6 +19,10 @@ void args_handler(
     case 'P':
         print_out = true;
         break;
+
+    case 't':
+        dtype = parse_dtype(optarg);
+        break;
     
     case '?':
         if (optopt == 'o')
@@ -42,7 +39,7 @@ void args_handler(
 
 int main(int argc, char** argv)
 {
-    parse_args(argc, argv, "Pf:", &args_handler);
+    parse_args(argc, argv, "Pf:t:", &args_handler);
 
     FILE* fp = fopen(file_path, "rb");
     if (fp == NULL)
@@ -51,26 +48,20 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    dtype data;
+    uint64_t data; // 8 bytes hold any element type
+    size_t item_size = dtype_size(dtype);
 
 
-    int cnt = 0;
-    while (fread(&data, sizeof(dtype), 1, fp) == 1)
+    unsigned long long cnt = 0;
+    while (fread(&data, item_size, 1, fp) == 1)
     {
         cnt++;
         if (print_out)
-        {
-            #ifdef USE_INT
-                printf("%d ", data);
-            #endif
-            #ifdef USE_FLT
-                printf("%f ", data);
-            #endif
-        }
+            dtype_print(dtype, &data);
     }
 
     if (feof(fp))
-        printf("\nfinish reading %s, total %d\n", file_path, cnt);
+        printf("\nfinish reading %s, total %llu\n", file_path, cnt);
     else
         printf("error reading data bin\n");
 
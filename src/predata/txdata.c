@@ -11,26 +11,15 @@ bool use_exp_G = false; // 2^30
 unsigned long num = 0;
 unsigned long epl = 0;
 
-#ifdef USE_INT
-    typedef int dtype;
-    const char* dtype_str = "INT";
+dtype_id dtype = DTYPE_DEFAULT;
+// file name prefix of every type, int32 and float keep their old names
+const char* dtype_str[] = {"INT", "INT64", "UINT32", "UINT64", "FLT", "DBL"};
 
-    int random_data(int seed)
-    {
-        int sign = (rand() % 2) * 2 - 1;  // 生成 -1 或 1
-        return sign * rand();
-    }
-#endif
-
-#ifdef USE_FLT
-    typedef float dtype;
-    const char* dtype_str = "FLT";
-
-    float random_data(float seed)
-    {
-        return 4 * seed * (1.0f - seed);
-    }
-#endif
+// rand() only gives 31 bits, wider integer types need several calls
+uint64_t random_bits()
+{
+    return ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 2) ^ (uint64_t)rand();
+}
 
 void args_handler(
     const int opt,
@@ -49,10 +38,13 @@ void args_handler(
         use_exp_G = true;
         break;
     case 'N':
-        num = atoi(optarg);
+        num = atol(optarg);
+        break;
+    case 't':
+        dtype = parse_dtype(optarg);
         break;
     case 'h':
-        printf("gendata [-MKG] -N <num>");
+        printf("gendata [-MKG] -N <num> [-t <%s>]", DTYPE_NAME_LIST);
         break;
     case '?':
         if (isprint(optopt))
@@ -67,7 +59,7 @@ void args_handler(
 
 int main(int argc, char** argv)
 {
-    parse_args(argc, argv, "hKMGN:", &args_handler);
+    parse_args(argc, argv, "hKMGN:t:", &args_handler);
 
     srand((unsigned int)time(NULL));
 
@@ -86,7 +78,7 @@ int main(int argc, char** argv)
     }
 
     char filename[128];
-    sprintf(filename, "%s%ld%s.bin", dtype_str, num, exp_str);
+    sprintf(filename, "%s%ld%s.bin", dtype_str[dtype], num, exp_str);
     printf("will write to %s\n", filename);
 
     FILE* fp = fopen(filename, "wb");
@@ -96,11 +88,30 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    dtype data = (dtype)rand() / (dtype)RAND_MAX;
+    // floating types follow the logistic map, integers are uniform
+    float fseed = (float)rand() / (float)RAND_MAX;
+    double dseed = (double)rand() / (double)RAND_MAX;
+    uint64_t data; // 8 bytes hold any element type
+    size_t item_size = dtype_size(dtype);
     for (size_t i = 0; i < num * epl; ++i)
     {
-        data = random_data(data);
-        size_t tx_cnt = fwrite(&data, sizeof(dtype), 1, fp);
+        switch (dtype)
+        {
+        case DTYPE_FLOAT:
+            fseed = 4 * fseed * (1.0f - fseed);
+            memcpy(&data, &fseed, sizeof(fseed));
+            break;
+        case DTYPE_DOUBLE:
+            dseed = 4 * dseed * (1.0 - dseed);
+            memcpy(&data, &dseed, sizeof(dseed));
+            break;
+        case DTYPE_INT32:
+            dtype_store(dtype, ((rand() % 2) * 2 - 1) * (long long)rand(), &data); // -1 or 1 times rand()
+            break;
+        default:
+            dtype_store_bits(dtype, random_bits(), &data);
+        }
+        size_t tx_cnt = fwrite(&data, item_size, 1, fp);
         if (tx_cnt < 1)
         {
             printf("failed to write data, abort\n");
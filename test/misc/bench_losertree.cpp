@@ -0,0 +1,184 @@
+#include <common_cpp.h>
+
+#ifdef USE_INT
+    typedef int dtype;
+#endif
+
+#ifdef USE_FLT
+    typedef float dtype;
+#endif
+
+// merge k in-memory sorted runs, only the selector cost is measured
+
+size_t item_num = 1 << 22;
+size_t cmp_cnt = 0;
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'n':
+        item_num = atol(optarg);
+        break;
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+typedef std::pair<dtype, int> head_t;
+
+// plain comparator type like kmerge_pass uses, so the selector can inline
+// it, comparisons are only counted in a separate untimed pass
+template<bool counted>
+struct head_greater
+{
+    bool operator()(const head_t& fp1, const head_t& fp2) const
+    {
+        if (counted) cmp_cnt++;
+        return fp1.first > fp2.first;
+    }
+};
+
+template<typename cmp_t>
+double bench_heap(const std::vector<std::vector<dtype>>& run_list, std::vector<dtype>& output)
+{
+    cmp_t cmpt;
+    std::vector<size_t> cursor(run_list.size(), 0);
+    size_t out_idx = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    heap<head_t, cmp_t> ksegheap(cmpt);
+    for (size_t i = 0; i < run_list.size(); ++i)
+        ksegheap.push(std::make_pair(run_list[i][cursor[i]++], (int)i));
+    while (!ksegheap.empty())
+    {
+        auto [head, run_idx] = ksegheap.top();
+        ksegheap.pop();
+        output[out_idx++] = head;
+        if (cursor[run_idx] < run_list[run_idx].size())
+            ksegheap.push(std::make_pair(run_list[run_idx][cursor[run_idx]++], run_idx));
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t2 - t1).count();
+}
+
+template<typename cmp_t>
+double bench_heap_replace(const std::vector<std::vector<dtype>>& run_list, std::vector<dtype>& output)
+{
+    cmp_t cmpt;
+    std::vector<size_t> cursor(run_list.size(), 0);
+    size_t out_idx = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    heap<head_t, cmp_t> ksegheap(cmpt, run_list.size());
+    for (size_t i = 0; i < run_list.size(); ++i)
+        ksegheap.emplace(run_list[i][cursor[i]++], (int)i);
+    while (!ksegheap.empty())
+    {
+        auto [head, run_idx] = ksegheap.top();
+        output[out_idx++] = head;
+        if (cursor[run_idx] < run_list[run_idx].size())
+            ksegheap.replace_top(std::make_pair(run_list[run_idx][cursor[run_idx]++], run_idx));
+        else
+            ksegheap.pop();
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t2 - t1).count();
+}
+
+template<typename cmp_t>
+double bench_loser_tree(const std::vector<std::vector<dtype>>& run_list, std::vector<dtype>& output)
+{
+    cmp_t cmpt;
+    std::vector<size_t> cursor(run_list.size(), 0);
+    size_t out_idx = 0;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::vector<head_t> head_list;
+    for (size_t i = 0; i < run_list.size(); ++i)
+        head_list.emplace_back(run_list[i][cursor[i]++], (int)i);
+    loser_tree<head_t, cmp_t> ksegtree(cmpt, std::move(head_list));
+    while (!ksegtree.empty())
+    {
+        auto [head, run_idx] = ksegtree.top();
+        output[out_idx++] = head;
+        if (cursor[run_idx] < run_list[run_idx].size())
+            ksegtree.replace_top(std::make_pair(run_list[run_idx][cursor[run_idx]++], run_idx));
+        else
+            ksegtree.pop();
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t2 - t1).count();
+}
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "n:", &args_handler);
+
+    std::mt19937 rng(0);
+    std::vector<dtype> output(item_num);
+    std::vector<dtype> expect;
+
+    cout << std::setw(6) << "k"
+         << std::setw(14) << "heap(s)" << std::setw(12) << "cmp/elem"
+         << std::setw(14) << "replace(s)" << std::setw(12) << "cmp/elem"
+         << std::setw(14) << "loser(s)" << std::setw(12) << "cmp/elem"
+         << std::setw(10) << "speedup" << endl;
+    // powers of two plus a few k that leave the tree and heap unbalanced
+    const size_t k_list[] = {2, 3, 4, 8, 16, 32, 64, 100, 128, 256, 512, 1000, 1024, 2048, 4096};
+    for (size_t k : k_list)
+    {
+        // split item_num random values into k sorted runs
+        std::vector<std::vector<dtype>> run_list(k);
+        expect.clear();
+        for (size_t i = 0; i < item_num; ++i)
+        {
+            dtype value = (dtype)(rng() % 1000000007);
+            run_list[i % k].emplace_back(value);
+            expect.emplace_back(value);
+        }
+        for (auto& run : run_list)
+            std::sort(run.begin(), run.end());
+        std::sort(expect.begin(), expect.end());
+
+        double heap_sec = bench_heap<head_greater<false>>(run_list, output);
+        cmp_cnt = 0;
+        bench_heap<head_greater<true>>(run_list, output);
+        double heap_cmp = (double)cmp_cnt / item_num;
+        if (output != expect)
+            fprintf(stderr, "heap merge order check failed for k=%zu\n", k);
+
+        double replace_sec = bench_heap_replace<head_greater<false>>(run_list, output);
+        cmp_cnt = 0;
+        bench_heap_replace<head_greater<true>>(run_list, output);
+        double replace_cmp = (double)cmp_cnt / item_num;
+        if (output != expect)
+            fprintf(stderr, "heap replace_top merge order check failed for k=%zu\n", k);
+
+        double tree_sec = bench_loser_tree<head_greater<false>>(run_list, output);
+        cmp_cnt = 0;
+        bench_loser_tree<head_greater<true>>(run_list, output);
+        double tree_cmp = (double)cmp_cnt / item_num;
+        if (output != expect)
+            fprintf(stderr, "loser tree merge order check failed for k=%zu\n", k);
+
+        cout << std::setw(6) << k
+             << std::setw(14) << heap_sec << std::setw(12) << heap_cmp
+             << std::setw(14) << replace_sec << std::setw(12) << replace_cmp
+             << std::setw(14) << tree_sec << std::setw(12) << tree_cmp
+             << std::setw(10) << heap_sec / tree_sec << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <common_cpp.h>
+
+#ifdef USE_INT
+    typedef int dtype;
+#endif
+
+#ifdef USE_FLT
+    typedef float dtype;
+#endif
+
+// compare std::sort with radix_sort on buffers of growing size
+
+int repeat = 3;
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'r':
+        repeat = std::max(1, atoi(optarg));
+        break;
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "r:", &args_handler);
+
+    std::mt19937 rng(0);
+    cout << std::setw(10) << "buf_size"
+         << std::setw(14) << "std::sort(s)"
+         << std::setw(14) << "radix(s)"
+         << std::setw(10) << "speedup" << endl;
+    for (size_t buf_size = 1 << 10; buf_size <= (1 << 24); buf_size <<= 2)
+    {
+        std::vector<dtype> origin(buf_size);
+        for (dtype& value : origin)
+        {
+            #ifdef USE_INT
+                value = (dtype)rng();
+            #endif
+            #ifdef USE_FLT
+                value = (dtype)((double)rng() / rng.max() * 2e6 - 1e6);
+            #endif
+        }
+
+        std::vector<dtype> expect(origin);
+        std::vector<dtype> actual(origin);
+        std::vector<dtype> scratch(buf_size);
+        double std_sec = 0.0;
+        double rdx_sec = 0.0;
+        for (int r = 0; r < repeat; ++r)
+        {
+            expect = origin;
+            auto t1 = std::chrono::high_resolution_clock::now();
+            std::sort(expect.begin(), expect.end());
+            auto t2 = std::chrono::high_resolution_clock::now();
+            std_sec += std::chrono::duration<double>(t2 - t1).count();
+
+            actual = origin;
+            t1 = std::chrono::high_resolution_clock::now();
+            radix_sort<dtype>(actual.data(), actual.size(), scratch.data());
+            t2 = std::chrono::high_resolution_clock::now();
+            rdx_sec += std::chrono::duration<double>(t2 - t1).count();
+        }
+        if (actual != expect)
+            fprintf(stderr, "radix sort order check failed for buf_size=%ld\n", buf_size);
+
+        cout << std::setw(10) << buf_size
+             << std::setw(14) << std_sec / repeat
+             << std::setw(14) << rdx_sec / repeat
+             << std::setw(10) << std_sec / rdx_sec << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <common_cpp.h>
+
+// sort key + payload records of 8, 16, 64 and 128 bytes, in memory with
+// std::sort on the key and with radix sort, then externally through
+// sort_file with the same memory budget for every size, payloads are
+// derived from the key so a record that lost its payload is caught
+
+size_t data_mb = 256;  // data sorted by sort_file per record size
+size_t buf_mb = 32;    // memory budget, also the in-memory run size
+int repeat = 3;
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'n':
+        data_mb = std::max(1, atoi(optarg));
+        break;
+
+    case 'm':
+        buf_mb = std::max(1, atoi(optarg));
+        break;
+
+    case 'r':
+        repeat = std::max(1, atoi(optarg));
+        break;
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+template<typename rtype>
+void fill_record(rtype& rec, std::mt19937_64& rng)
+{
+    rec.key = (decltype(rec.key))rng();
+    for (size_t i = 0; i < sizeof(rec.payload); ++i)
+        rec.payload[i] = (unsigned char)(rec.key * 131 + i);
+}
+
+// keys ascend and every payload still belongs to its key
+template<typename rtype>
+bool check_records(const rtype* data, const size_t& item_cnt)
+{
+    for (size_t i = 0; i < item_cnt; ++i)
+    {
+        if (i > 0 && data[i].key < data[i - 1].key)
+            return false;
+        for (size_t j = 0; j < sizeof(data[i].payload); ++j)
+            if (data[i].payload[j] != (unsigned char)(data[i].key * 131 + j))
+                return false;
+    }
+    return true;
+}
+
+double elapsed(const std::function<void()>& work)
+{
+    auto t1 = std::chrono::high_resolution_clock::now();
+    work();
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t2 - t1).count();
+}
+
+template<typename rtype>
+void bench(const char* name)
+{
+    std::mt19937_64 rng(sizeof(rtype));
+    size_t buf_size = (buf_mb << 20) / sizeof(rtype);
+    bool ok = true;
+
+    // in memory, one run of the memory budget
+    std::vector<rtype> origin(buf_size);
+    for (rtype& rec : origin)
+        fill_record(rec, rng);
+
+    std::vector<rtype> actual(origin);
+    std::vector<rtype> scratch(buf_size);
+    double std_sec = 0.0;
+    double rdx_sec = 0.0;
+    for (int r = 0; r < repeat; ++r)
+    {
+        actual = origin;
+        std_sec += elapsed([&]() { std::sort(actual.begin(), actual.end(), key_less<rtype>()); });
+        ok &= check_records(actual.data(), buf_size);
+
+        actual = origin;
+        rdx_sec += elapsed([&]() { radix_sort<rtype>(actual.data(), buf_size, scratch.data()); });
+        ok &= check_records(actual.data(), buf_size);
+    }
+    std::vector<rtype>().swap(origin);
+    std::vector<rtype>().swap(actual);
+    std::vector<rtype>().swap(scratch);
+
+    // external, data_mb through sort_file with the same budget
+    std::filesystem::path base = "data/bench_record";
+    std::filesystem::create_directories(base);
+    std::string input_path = (base / "input.bin").string();
+    std::string output_path = (base / "sorted.bin").string();
+    size_t item_cnt = (data_mb << 20) / sizeof(rtype);
+    {
+        block_writer<rtype> foutput(input_path, KMERGE_MIN_BLOCK);
+        rtype rec;
+        for (size_t i = 0; i < item_cnt; ++i)
+        {
+            fill_record(rec, rng);
+            foutput.put(rec);
+        }
+        foutput.close();
+    }
+    int merge_pass = 0;
+    double file_sec = elapsed([&]() {
+        merge_pass = sort_file<rtype>(input_path, output_path, buf_size, 0);
+    });
+    {
+        run_view<rtype> sorted_run(output_path);
+        ok &= sorted_run.size() == item_cnt;
+        std::vector<rtype> block(KMERGE_MIN_BLOCK);
+        typename sort_key<rtype>::key_type last_key = 0;
+        for (size_t done = 0; done < sorted_run.size(); done += block.size())
+        {
+            size_t cnt = sorted_run.read(done, std::min(block.size(), sorted_run.size() - done), block.data());
+            ok &= check_records(block.data(), cnt) && (cnt == 0 || !(block[0].key < last_key));
+            if (cnt > 0) last_key = block[cnt - 1].key;
+        }
+    }
+    std::filesystem::remove_all(base);
+    std::filesystem::remove_all(segment_path(0, 0).parent_path());
+
+    cout << std::setw(8) << name
+         << std::setw(12) << buf_size
+         << std::setw(14) << std_sec / repeat
+         << std::setw(12) << rdx_sec / repeat
+         << std::setw(14) << file_sec
+         << std::setw(8) << merge_pass
+         << std::setw(10) << (double)data_mb / file_sec
+         << "  " << (ok ? "ok" : "FAILED") << endl;
+}
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "n:m:r:", &args_handler);
+
+    cout << "memory budget " << buf_mb << " MiB, sort_file input " << data_mb << " MiB" << endl;
+    cout << std::setw(8) << "record"
+         << std::setw(12) << "run_len"
+         << std::setw(14) << "std::sort(s)"
+         << std::setw(12) << "radix(s)"
+         << std::setw(14) << "sort_file(s)"
+         << std::setw(8) << "passes"
+         << std::setw(10) << "MiB/s" << endl;
+    bench<record<uint32_t, 8>>("rec8");
+    bench<record<uint64_t, 16>>("rec16");
+    bench<record<uint64_t, 64>>("rec64");
+    bench<record<uint64_t, 128>>("rec128");
+    return 0;
+}
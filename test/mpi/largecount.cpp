@@ -0,0 +1,255 @@
+#include <common_cpp.h>
+#include <mpi/mpi.h>
+#include <common_mpi.h>
+#include <splitter.h>
+
+namespace fs = std::filesystem;
+
+// every rank sorts a partition of -g GiB int32 (default 9, more than 2^31
+// elements) and runs the psrs steps on it: local sort_file, splitter
+// selection, tie split, the MPI_Ialltoallv exchange (-S merges the
+// streams on arrival) and the final merge of the received segments, the
+// merged partitions are checked for order across ranks, count and
+// checksum against the generated data, -w additionally writes all
+// partitions into one file with parallel_write
+
+double gib_per_rank = 9.0;
+int buf_size = 1 << 26;
+bool stream_merge = false;
+bool write_result = false;
+bool keep_files = false;
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'g':
+        if ((gib_per_rank = atof(optarg)) <= 0)
+        {
+            fprintf(stderr, "invalid partition size %s\n", optarg);
+            exit(1);
+        }
+        break;
+
+    case 'b':
+        if ((buf_size = atoi(optarg)) <= 0)
+        {
+            fprintf(stderr, "invalid buffer size %s\n", optarg);
+            exit(1);
+        }
+        break;
+
+    case 'S':
+        stream_merge = true;
+        break;
+
+    case 'w':
+        write_result = true;
+        break;
+
+    case 'k':
+        keep_files = true;
+        break;
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+// order independent checksum of a multiset of values
+struct checksum
+{
+    uint64_t sum = 0;
+    uint64_t mix = 0;
+
+    void add(const int32_t& value)
+    {
+        uint64_t bits = (uint32_t)value;
+        sum += bits;
+        mix += bits * bits * 0x9e3779b97f4a7c15ull;
+    }
+
+    // sum of the checksums of every rank, unsigned sums wrap consistently
+    checksum global(MPI_Comm comm) const
+    {
+        checksum total;
+        MPI_Allreduce(&sum, &total.sum, 1, MPI_UINT64_T, MPI_SUM, comm);
+        MPI_Allreduce(&mix, &total.mix, 1, MPI_UINT64_T, MPI_SUM, comm);
+        return total;
+    }
+
+    bool operator==(const checksum& other) const
+    {
+        return sum == other.sum && mix == other.mix;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "g:b:Swk", &args_handler);
+
+    mpi_init_funneled(&argc, &argv);
+    int world_size, world_rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+    fs::path base = fs::path("data/node") / std::to_string(world_rank);
+    fs::path input_path = base / "recv.bin";
+    fs::path sorted_path = base / "sorted.bin";
+    fs::path merged_path = base / "merged.bin";
+    fs::create_directories(base);
+    int failed = 0;
+
+    // generate the partition
+    uint64_t item_cnt = (uint64_t)(gib_per_rank * (1ull << 30)) / sizeof(int32_t);
+    checksum expect;
+    {
+        std::mt19937_64 rng(world_rank + 1);
+        block_writer<int32_t> foutput(input_path.string(), KMERGE_MIN_BLOCK);
+        for (uint64_t i = 0; i < item_cnt; ++i)
+        {
+            int32_t value = (int32_t)rng();
+            expect.add(value);
+            foutput.put(value);
+        }
+        foutput.close();
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    int merge_pass = sort_file<int32_t>(input_path.string(), sorted_path.string(), buf_size, world_rank);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    fs::remove(input_path);
+
+    // the sorted run keeps every element and is ordered
+    {
+        block_reader<int32_t> finput(sorted_path.string(), KMERGE_MIN_BLOCK);
+        checksum actual;
+        uint64_t sorted_cnt = 0;
+        int32_t prev = INT32_MIN, curr;
+        bool ordered = true;
+        while (finput.next(curr))
+        {
+            ordered &= prev <= curr;
+            actual.add(curr);
+            prev = curr;
+            sorted_cnt++;
+        }
+        bool ok = ordered && sorted_cnt == item_cnt && actual == expect;
+        failed += !ok;
+        printf("node%d sorted %llu elements (%s 2^31) in %.1fs, %d merge pass(es), order %s, count %s, checksum %s\n",
+            world_rank, (unsigned long long)sorted_cnt, sorted_cnt > (1ull << 31) ? "above" : "below",
+            std::chrono::duration<double>(t2 - t1).count(), merge_pass,
+            ordered ? "ok" : "FAILED", sorted_cnt == item_cnt ? "ok" : "FAILED", actual == expect ? "ok" : "FAILED");
+    }
+
+    // psrs exchange and final merge, the partitions stay above 2^31 elements
+    uint64_t merged_cnt = 0;
+    {
+        exchange_stat exchange;
+        {
+            run_view<int32_t> sorted_run(sorted_path);
+            std::vector<int32_t> pivot_list = pick_splitters(regular_sample(sorted_run, world_size), MPI_INT32_T, 0);
+            std::vector<size_t> seg_head = tie_split_bounds(sorted_run, pivot_list);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            exchange = exchange_segments(sorted_run, seg_head, base, buf_size, stream_merge);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            printf("node%d exchanged in %.1fs, %llu round(s)\n", world_rank,
+                std::chrono::duration<double>(t2 - t1).count(), (unsigned long long)exchange.round_cnt);
+        }
+        fs::remove(sorted_path);
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        int merge_pass = 0;
+        if (stream_merge)
+            fs::rename(base / "merge.bin", merged_path);
+        else
+            merge_pass = merge_segments<int32_t>(base, merged_path, buf_size);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        fs::remove_all(base / "seg");
+
+        block_reader<int32_t> finput(merged_path.string(), KMERGE_MIN_BLOCK);
+        checksum actual;
+        int32_t first = INT32_MAX, prev = INT32_MIN, curr;
+        bool ordered = true;
+        while (finput.next(curr))
+        {
+            if (merged_cnt == 0) first = curr;
+            ordered &= prev <= curr;
+            actual.add(curr);
+            prev = curr;
+            merged_cnt++;
+        }
+        uint64_t expect_cnt = std::accumulate(exchange.recv_tlt_list.begin(), exchange.recv_tlt_list.end(), (uint64_t)0);
+        bool ok = ordered && merged_cnt == expect_cnt;
+        failed += !ok;
+        printf("node%d merged %llu elements (%s 2^31) in %.1fs, %d merge pass(es), order %s, count %s\n",
+            world_rank, (unsigned long long)merged_cnt, merged_cnt > (1ull << 31) ? "above" : "below",
+            std::chrono::duration<double>(t2 - t1).count(), merge_pass,
+            ordered ? "ok" : "FAILED", merged_cnt == expect_cnt ? "ok" : "FAILED");
+
+        // partitions follow each other in rank order and together hold
+        // exactly the generated data
+        int32_t bound[2] = {first, prev};
+        int has = merged_cnt > 0;
+        std::vector<int32_t> all_bound(2 * world_size);
+        std::vector<int> all_has(world_size);
+        MPI_Allgather(bound, 2, MPI_INT32_T, all_bound.data(), 2, MPI_INT32_T, MPI_COMM_WORLD);
+        MPI_Allgather(&has, 1, MPI_INT, all_has.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        bool across = true;
+        int32_t last = INT32_MIN;
+        for (int i = 0; i < world_size; ++i)
+        {
+            if (!all_has[i]) continue;
+            across &= last <= all_bound[2 * i];
+            last = all_bound[2 * i + 1];
+        }
+        uint64_t global_cnt = 0, global_merged = 0;
+        MPI_Allreduce(&item_cnt, &global_cnt, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(&merged_cnt, &global_merged, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        bool sum_ok = actual.global(MPI_COMM_WORLD) == expect.global(MPI_COMM_WORLD);
+        ok = across && global_merged == global_cnt && sum_ok;
+        failed += world_rank == 0 && !ok;
+        if (world_rank == 0)
+            printf("global order %s, count %llu of %llu %s, checksum %s\n", across ? "ok" : "FAILED",
+                (unsigned long long)global_merged, (unsigned long long)global_cnt,
+                global_merged == global_cnt ? "ok" : "FAILED", sum_ok ? "ok" : "FAILED");
+    }
+
+    if (write_result)
+    {
+        fs::path result_path = "data/largecount_result.bin";
+        uint64_t offset = parallel_write<int32_t>(merged_path, result_path.c_str(), MPI_INT32_T, buf_size);
+        uint64_t expect_off = 0;
+        MPI_Exscan(&merged_cnt, &expect_off, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        if (world_rank == 0) expect_off = 0;
+
+        // the last element of this partition landed at offset + merged_cnt - 1
+        run_view<int32_t> result_run(result_path);
+        run_view<int32_t> merged_run(merged_path);
+        bool ok = offset == expect_off && result_run.size() >= offset + merged_cnt
+            && (merged_cnt == 0 || result_run.at(offset + merged_cnt - 1) == merged_run.at(merged_cnt - 1));
+        failed += !ok;
+        printf("node%d parallel write at offset %llu %s\n", world_rank, (unsigned long long)offset, ok ? "ok" : "FAILED");
+        MPI_Barrier(MPI_COMM_WORLD);
+        if (!keep_files && world_rank == 0)
+            fs::remove(result_path);
+    }
+
+    if (!keep_files)
+        fs::remove_all(base);
+
+    int global_failed = 0;
+    MPI_Allreduce(&failed, &global_failed, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Finalize();
+    return global_failed > 0;
+}
@@ -0,0 +1,151 @@
+#include <common_cpp.h>
+#include <mpi/mpi.h>
+#include <splitter.h>
+
+namespace fs = std::filesystem;
+
+// stress tie_split_bounds with duplicate heavy runs on every rank, the
+// partition sizes are compared with the plain upper_bound split, and
+// tie_split_at with the single pivot halving of a hypercube round
+
+int item_num = 1 << 16; // elements per rank
+
+void args_handler(
+    const int opt,
+    const int optopt,
+    const int optind,
+    char* optarg
+) {
+    switch (opt)
+    {
+    case 'n':
+        item_num = atoi(optarg);
+        break;
+
+    case '?':
+        if (isprint(optopt))
+            fprintf(stderr, "Unknown option `-%c'.\n", optopt);
+        else
+            fprintf(stderr, "Unknown option character `\\x%x'.\n", optopt);
+        break;
+    default:
+        abort();
+    }
+}
+
+// global max / avg partition size of the segments given by bound
+double imbalance(const std::vector<size_t>& bound, const int& world_size)
+{
+    std::vector<uint64_t> send_cnt(world_size);
+    for (int i = 0; i < world_size; ++i)
+        send_cnt[i] = bound[i + 1] - bound[i];
+    std::vector<uint64_t> part_cnt(world_size);
+    MPI_Allreduce(send_cnt.data(), part_cnt.data(), world_size, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    uint64_t part_max = *std::max_element(part_cnt.begin(), part_cnt.end());
+    uint64_t part_sum = std::accumulate(part_cnt.begin(), part_cnt.end(), (uint64_t)0);
+    return part_sum > 0 ? (double)part_max * world_size / part_sum : 1.0;
+}
+
+// every key of segment i must not be greater than any key of segment i + 1
+bool ordered(const std::vector<int>& run, const std::vector<size_t>& bound, const int& world_size)
+{
+    std::vector<int> local_max(world_size, INT32_MIN), local_min(world_size, INT32_MAX);
+    for (int i = 0; i < world_size; ++i)
+    {
+        if (bound[i] > bound[i + 1] || bound[i + 1] > run.size())
+            return false;
+        if (bound[i] == bound[i + 1]) continue;
+        local_min[i] = run[bound[i]];
+        local_max[i] = run[bound[i + 1] - 1];
+    }
+    std::vector<int> seg_max(world_size), seg_min(world_size);
+    MPI_Allreduce(local_max.data(), seg_max.data(), world_size, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(local_min.data(), seg_min.data(), world_size, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    for (int i = 0; i + 1 < world_size; ++i)
+    {
+        if (seg_max[i] == INT32_MIN) continue;
+        for (int j = i + 1; j < world_size; ++j)
+            if (seg_min[j] != INT32_MAX && seg_max[i] > seg_min[j])
+                return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv, "n:", &args_handler);
+
+    MPI_Init(&argc, &argv);
+    int world_size, world_rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+    fs::path run_path = fs::path("data/tiesplit") / (std::to_string(world_rank) + ".bin");
+    fs::create_directories(run_path.parent_path());
+
+    // (distinct keys, percentage of the hot key 0)
+    std::vector<std::pair<int, int>> case_list = {
+        {1, 100}, {2, 0}, {4, 0}, {1000, 90}, {1000, 50}, {1000000, 0}
+    };
+    std::mt19937 rng(world_rank + 1);
+    int failed = 0;
+    for (const auto& [key_cnt, hot_pct] : case_list)
+    {
+        std::vector<int> run(item_num);
+        for (int& value : run)
+            value = ((int)(rng() % 100) < hot_pct) ? 0 : (int)(rng() % key_cnt);
+        std::sort(run.begin(), run.end());
+        {
+            std::ofstream foutput(run_path, std::ofstream::binary);
+            foutput.write(reinterpret_cast<char*>(run.data()), sizeof(int) * run.size());
+        }
+
+        run_view<int> sorted_run(run_path);
+        std::vector<int> pivot_list = pick_splitters(regular_sample(sorted_run, world_size), MPI_INT, 0);
+
+        std::vector<size_t> plain_bound(world_size + 1);
+        plain_bound[world_size] = sorted_run.size();
+        for (int i = 1; i < world_size; ++i)
+            plain_bound[i] = sorted_run.upper_bound(pivot_list[i - 1], plain_bound[i - 1]);
+        std::vector<size_t> tie_bound = tie_split_bounds(sorted_run, pivot_list);
+
+        double plain_ratio = imbalance(plain_bound, world_size);
+        double tie_ratio = imbalance(tie_bound, world_size);
+        bool ok = ordered(run, tie_bound, world_size);
+        // the hot key alone covers hot_pct of the data, ties have to be cut
+        // finely enough to stay near N / P
+        if (hot_pct == 100 && tie_ratio > 1.0 + (double)world_size / item_num)
+            ok = false;
+
+        // hqsort halves every subcube at one pivot, the lower half should get
+        // half of the elements whenever the ties of the pivot reach that far
+        uint64_t local_cnt = sorted_run.size();
+        uint64_t global_cnt = 0;
+        MPI_Allreduce(&local_cnt, &global_cnt, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        int pivot = pivot_list.empty() ? 0 : pivot_list[pivot_list.size() / 2];
+        uint64_t half = global_cnt / 2;
+        std::vector<size_t> half_bound(world_size + 1, sorted_run.size());
+        half_bound[0] = 0;
+        half_bound[1] = tie_split_at(sorted_run, pivot, half);
+        uint64_t local_less = sorted_run.lower_bound(pivot);
+        uint64_t local_upto = sorted_run.upper_bound(pivot);
+        uint64_t local_below = half_bound[1];
+        uint64_t global_less = 0, global_upto = 0, global_below = 0;
+        MPI_Allreduce(&local_less, &global_less, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(&local_upto, &global_upto, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(&local_below, &global_below, 1, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        bool half_ok = ordered(run, half_bound, world_size)
+            && global_below == std::min(std::max(half, global_less), global_upto);
+        ok &= half_ok;
+        failed += !ok;
+
+        if (world_rank == 0)
+            printf("keys %8d hot %3d%%  upper_bound imbalance %8.4f  tie split imbalance %8.4f  lower half %5.1f%%  %s\n",
+                key_cnt, hot_pct, plain_ratio, tie_ratio,
+                global_cnt > 0 ? 100.0 * global_below / global_cnt : 0.0, ok ? "ok" : "FAILED");
+    }
+
+    fs::remove(run_path);
+    MPI_Finalize();
+    return failed > 0;
+}